@@ -36,107 +36,6 @@
 // MARK: UMPacket
 //
 
-int UMPacket::messageTypeToSize(MessageType mt)
-{
-	switch (mt)
-	{
-	/*0*/ case Utility:    return 1;
-	/*1*/ case System:     return 1;
-	/*2*/ case M1ChannelVoice: return 1;
-	/*3*/ case Data64:     return 2;
-	/*4*/ case M2ChannelVoice: return 2;
-	/*5*/ case Data128:    return 4;
-	/*6*/ case Reserved6:  return 1;
-	/*7*/ case Reserved7:  return 1;
-	/*8*/ case Reserved8:  return 2;
-	/*9*/ case Reserved9:  return 2;
-	/*A*/ case Reserved10: return 2;
-	/*B*/ case Reserved11: return 3;
-	/*C*/ case Reserved12: return 3;
-	/*D*/ case Reserved13: return 4;
-	/*E*/ case Reserved14: return 4;
-	/*F*/ case Reserved15: return 4;
-	case MessageTypeCOUNT:
-		break;
-	}
-	return 0;
-}
-
-
-const char* UMPacket::messageTypeToString(MessageType mt)
-{
-	switch (mt)
-	{
-	/*0*/ case Utility:    return "Utility";
-	/*1*/ case System:     return "System";
-	/*2*/ case M1ChannelVoice: return "MIDI1ChannelVoice";
-	/*3*/ case Data64:     return "Data64";
-	/*4*/ case M2ChannelVoice: return "MIDI2ChannelVoice";
-	/*5*/ case Data128:    return "Data128";
-	/*6*/ case Reserved6:  return "Reserved6";
-	/*7*/ case Reserved7:  return "Reserved7";
-	/*8*/ case Reserved8:  return "Reserved8";
-	/*9*/ case Reserved9:  return "Reserved9";
-	/*A*/ case Reserved10: return "Reserved10";
-	/*B*/ case Reserved11: return "Reserved11";
-	/*C*/ case Reserved12: return "Reserved12";
-	/*D*/ case Reserved13: return "Reserved13";
-	/*E*/ case Reserved14: return "Reserved14";
-	/*F*/ case Reserved15: return "Reserved15";
-	case MessageTypeCOUNT:
-		break;
-	}
-	return "";
-}
-
-
-const char* UMPacket::m1ChannelVoiceStatusToString(M1ChannelVoiceStatus status)
-{
-	switch (status)
-	{
-	case M1StatusNoteOff: return "NoteOff";
-	case M1StatusNoteOn: return "NoteOn";
-	case M1StatusPressure: return "Pressure";
-	case M1StatusControlChange: return "ControlChange";
-	case M1StatusProgramChange: return "ProgramChange";
-	case M1StatusChannelPressure: return "ChannelPressure";
-	case M1StatusPitchBend: return "PitchBend";
-	}
-	return "";
-}
-
-
-const char* UMPacket::m2ChannelVoiceStatusToString(M2ChannelVoiceStatus status)
-{
-	switch (status)
-	{
-	case M2StatusRegisteredPerNoteCC: return "RegisteredPerNoteCC";
-	case M2StatusAssignablePerNoteCC: return "AssignablePerNoteCC";
-	case M2StatusRegisteredCC: return "RegisteredCC";
-	case M2StatusAssignableCC: return "AssignableCC";
-	case M2StatusRelativeRegisteredCC: return "RelativeRegisteredCC";
-	case M2StatusRelativeAssignableCC: return "RelativeAssignableCC";
-	case M2StatusPerNotePitchBend: return "PerNotePitchBend";
-	case M2StatusReserved7: return "Reserved7";
-	case M2StatusNoteOff: return "NoteOff";
-	case M2StatusNoteOn: return "NoteOn";
-	case M2StatusPressure: return "Pressure";
-	case M2StatusControlChange: return "ControlChange";
-	case M2StatusProgramChange: return "ProgramChange";
-	case M2StatusChannelPressure: return "ChannelPressure";
-	case M2StatusPitchBend: return "PitchBend";
-	case M2StatusPerNoteManagement: return "PerNoteManagement";
-	}
-	return "";
-}
-
-
-UMPacket::UMPacket()
-{
-	memset(data, 0, sizeof(data));
-}
-
-
 UMPacket::UMPacket(const byte* d, int sizeInBytes)
 {
 	if (sizeInBytes > (int)sizeof(data))
@@ -164,167 +63,139 @@ UMPacket::UMPacket(const uint32* d, int count)
 }
 
 
-UMPacket::UMPacket(uint32 d)
+UMPacket::UMPacket(const UMPView& view)
 {
-	data[0] = d;
-}
-
-
-UMPacket::UMPacket(uint32 data1, uint32 data2)
-{
-	data[0] = data1;
-	data[1] = data2;
-}
-
-
-UMPacket::UMPacket(uint32 data1, uint32 data2, uint32 data3)
-{
-	data[0] = data1;
-	data[1] = data2;
-	data[2] = data3;
-}
-
-
-UMPacket::UMPacket(uint32 data1, uint32 data2, uint32 data3, uint32 data4)
-{
-	data[0] = data1;
-	data[1] = data2;
-	data[2] = data3;
-	data[3] = data4;
-}
-
-
-UMPacket& UMPacket::initNoteOff(uint4 group, uint4 channel, uint7 noteNumber, uint16 velocity, uint8 attributeType, uint16 attribute)
-{
-	setM2ChannelVoice(group, M2StatusNoteOff, channel, (byte)(noteNumber & 0x7F), (byte)(attributeType & 0xFF));
-	setWord(1, velocity, attribute);
-	return *this;
-}
-
-
-UMPacket& UMPacket::initNoteOff(uint4 group, uint4 channel, uint7 noteNumber, uint16 velocity)
-{
-	setM2ChannelVoice(group, M2StatusNoteOff, channel, (byte)(noteNumber & 0x7F), AttributeNone);
-	setWord(1, velocity, 0);
-	return *this;
-}
-
-UMPacket& UMPacket::initNoteOn(uint4 group, uint4 channel, uint7 noteNumber, uint16 velocity, uint8 attributeType, uint16 attribute)
-{
-	setM2ChannelVoice(group, M2StatusNoteOn, channel, (byte)(noteNumber & 0x7F), (byte)(attributeType & 0xFF));
-	setWord(1, velocity, attribute);
-	return *this;
-}
-
-
-UMPacket& UMPacket::initNoteOn(uint4 group, uint4 channel, uint7 noteNumber, uint16 velocity)
-{
-	setM2ChannelVoice(group, M2StatusNoteOn, channel, (byte)(noteNumber & 0x7F), AttributeNone);
-	setWord(1, velocity, 0);
-	return *this;
-}
-
-UMPacket& UMPacket::initPolyPressure(uint4 group, uint4 channel, uint7 noteNumber, uint32 pressure)
-{
-	setM2ChannelVoice(group, M2StatusPressure, channel, (byte)(noteNumber & 0x7F), 0);
-	setWord(1, pressure);
-	return *this;
+	memset(data, 0, sizeof(data));
+	int count = view.getSizeInWords();
+	if (count > 4)
+	{
+		count = 4;
+	}
+	if (count > 0)
+	{
+		memcpy((void*)data, (const void*)view.getData(), count * 4);
+	}
 }
 
 
-UMPacket& UMPacket::initControlChange(uint4 group, uint4 channel, uint7 controllerIndex, uint32 value)
-{
-	setM2ChannelVoice(group, M2StatusControlChange, channel, (byte)(controllerIndex & 0x7F), 0);
-	setWord(1, value);
-	return *this;
-}
-
-UMPacket& UMPacket::initAssignableCC(uint4 group, uint4 channel, uint7 bank, uint7 index, uint32 value)
-{
-	setM2ChannelVoice(group, M2StatusAssignableCC, channel, (byte)(bank & 0x7F), (byte)(index & 0x7F));
-	setWord(1, value);
-	return *this;
-}
+static const char hexDigits[] = "0123456789ABCDEF";
 
-UMPacket& UMPacket::initRegisteredCC(uint4 group, uint4 channel, uint7 bank, uint7 index, uint32 value)
+static inline char* appendString(char* out, const char* s)
 {
-	setM2ChannelVoice(group, M2StatusRegisteredCC, channel, (byte)(bank & 0x7F), (byte)(index & 0x7F));
-	setWord(1, value);
-	return *this;
+	while (*s != 0)
+	{
+		*out++ = *s++;
+	}
+	return out;
 }
 
-
-UMPacket& UMPacket::initProgramChange(uint4 group, uint4 channel, uint8 optionFlags, uint7 program, uint7 bankLSB, uint7 bankMSB)
+static inline char* appendHex(char* out, uint32 value, int digits)
 {
-	setM2ChannelVoice(group, M2StatusProgramChange, channel, 0, optionFlags);
-	setWord(1, (byte)(program & 0x7F), 0, (byte)(bankMSB & 0x7F), (byte)(bankLSB & 0x7F));
-	return *this;
+	for (int shift = (digits - 1) * 4; shift >= 0; shift -= 4)
+	{
+		*out++ = hexDigits[(value >> shift) & 0xF];
+	}
+	return out;
 }
 
 
-UMPacket& UMPacket::initChannelPressure(uint4 group, uint4 channel, uint32 value)
+int UMPacket::format(char* buffer, size_t size) const
 {
-	setM2ChannelVoice(group, M2StatusChannelPressure, channel, 0, 0);
-	setWord(1, value);
-	return *this;
-}
-
+	if (buffer == nullptr || size == 0)
+	{
+		return 0;
+	}
+	// format in place if the buffer is large enough, otherwise truncate a copy
+	char tmp[MaxFormattedLength];
+	char* start = (size >= (size_t)MaxFormattedLength) ? buffer : tmp;
+	char* out = start;
+	int sizeInWords = getSizeInWords();
+
+	out = appendString(out, "MIDI 2 packet (");
+	*out++ = (char)('0' + sizeInWords);
+	out = appendString(out, " words): ");
+	for (int shift = 28; shift >= 16; shift -= 4)
+	{
+		out = appendHex(out, data[0] >> shift, 1);
+		*out++ = ' ';
+	}
+	out = appendHex(out, data[0] >> 8, 2);
+	*out++ = ' ';
+	out = appendHex(out, data[0], 2);
+	if (sizeInWords > 1)
+	{
+		*out++ = ' ';
+		out = appendHex(out, data[1] >> 16, 4);
+		*out++ = ' ';
+		out = appendHex(out, data[1], 4);
+	}
+	if (sizeInWords > 2)
+	{
+		out = appendString(out, "...");
+	}
+	out = appendString(out, ": ");
+	out = appendString(out, messageTypeToString(getMessageType()));
+	if (getMessageType() == M2ChannelVoice)
+	{
+		*out++ = ' ';
+		out = appendString(out, m2ChannelVoiceStatusToString(getM2Status()));
+	}
 
-UMPacket& UMPacket::initPitchBend(uint4 group, uint4 channel, uint32 value)
-{
-	setM2ChannelVoice(group, M2StatusPitchBend, channel, 0, 0);
-	setWord(1, value);
-	return *this;
+	int length = (int)(out - start);
+	if (start == tmp)
+	{
+		if ((size_t)length > size - 1)
+		{
+			length = (int)(size - 1);
+		}
+		memcpy(buffer, tmp, (size_t)length);
+	}
+	buffer[length] = 0;
+	return length;
 }
 
 
-UMPacket& UMPacket::initPerNoteAssignableCC(uint4 group, uint4 channel, uint7 noteNumber, uint7 index, uint32 value)
-{
-    setM2ChannelVoice(group, M2StatusAssignablePerNoteCC, channel, (byte)(noteNumber & 0x7F), (byte)(index & 0x7F));
-    setWord(1, value);
-    return *this;
-}
-
-UMPacket& UMPacket::initPerNoteRegisteredCC(uint4 group, uint4 channel, uint7 noteNumber, uint7 index, uint32 value)
+const char* UMPacket::toString() const
 {
-    setM2ChannelVoice(group, M2StatusRegisteredPerNoteCC, channel, (byte)(noteNumber & 0x7F), (byte)(index & 0x7F));
-    setWord(1, value);
-    return *this;
+	static thread_local char buf[MaxFormattedLength];
+	format(buf, sizeof(buf));
+	return buf;
 }
 
-UMPacket& UMPacket::initPerNoteManagement(uint4 group, uint4 channel, uint7 noteNumber, uint8 optionFlags/*PerNoteManagementFlag*/)
-{
-    setM2ChannelVoice(group, M2StatusPerNoteManagement, channel, (byte)(noteNumber & 0x7F), optionFlags);
-    setWord(1, 0);
-    return *this;
-}
 
+//
+// MARK: UMPBlockBuffer
+//
 
-const char* UMPacket::toString() const
+int UMPBlockBuffer::add(uint64 timestamp, const uint32* rawWords, int rawSizeInWords, bool* incomplete)
 {
-	// quick&dirty, not thread safe!
-	static char buf[2048];
-	static char msg[1024];
-
-	sprintf(msg, "%01X %01X %01X %01X %02X %02X",
-		data[0] >> 28, (data[0] >> 24) & 0xF, (data[0] >> 20) & 0xF, (data[0] >> 16) & 0xF, (data[0] >> 8) & 0xFF, data[0] & 0xFF);
-	if (getSizeInWords() > 1)
+	if (incomplete != nullptr)
 	{
-		char* tmp = msg;
-		tmp += strlen(msg);
-		sprintf(tmp, " %04X %04X", data[1] >> 16, data[1] & 0xFFFF);
+		*incomplete = false;
 	}
-
-	sprintf(buf, "MIDI 2 packet (%d words): %s%s: %s", getSizeInWords(), msg,
-		getSizeInWords() > 2 ? "..." : "",
-		messageTypeToString(getMessageType()));
-	if (getMessageType() == M2ChannelVoice)
+	int consumed = 0;
+	while (consumed < rawSizeInWords)
 	{
-		char* tmp = buf;
-		tmp += strlen(buf);
-		sprintf(tmp, " %s", m2ChannelVoiceStatusToString(getM2Status()));
+		int packetSize = UMPacket::wordToSize(rawWords[consumed]);
+		if (consumed + packetSize > rawSizeInWords)
+		{
+			if (incomplete != nullptr)
+			{
+				*incomplete = true;
+			}
+			break;
+		}
+		if (sizeInWords + packetSize > MaxWords)
+		{
+			break;
+		}
+		memcpy((void*)&words[sizeInWords], (const void*)&rawWords[consumed], packetSize * 4);
+		timestamps[packetCount] = timestamp;
+		sizeInWords += packetSize;
+		packetCount++;
+		consumed += packetSize;
 	}
-	return buf;
+	return consumed;
 }
 
 
@@ -332,43 +203,19 @@ const char* UMPacket::toString() const
 // MIDI2Processor base class
 //
 
+void MIDI2Processor::process(uint64 timestamp, UMPView packet)
+{
+    process(timestamp, UMPacket(packet));
+}
+
+
 void MIDI2Processor::processRawUMP(uint64 timestamp, const uint32* rawWords, int sizeInWords)
 {
-    if (rawWords == nullptr)
-    {
-        return;
-    }
-    UMPacket packet;
-    while (sizeInWords > 0)
-    {
-        packet.setWord(0, rawWords[0]);
-        int packetSize = packet.getSizeInWords();
-        if (sizeInWords < packetSize)
-        {
-            onCorruptRawData("incomplete UMP received.");
-        }
-        else
-        {
-            switch (packetSize)
-            {
-                case 2:
-                    packet.setWord(1, rawWords[1]);
-                    break;
-                case 3:
-                    packet.setWord(1, rawWords[1]);
-                    packet.setWord(2, rawWords[2]);
-                    break;
-                case 4:
-                    packet.setWord(1, rawWords[1]);
-                    packet.setWord(2, rawWords[2]);
-                    packet.setWord(3, rawWords[3]);
-                    break;
-            }// switch
+    forEachPacket(timestamp, rawWords, sizeInWords, [this](uint64 ts, UMPView packet) { process(ts, packet); });
+}
+
 
-            process(timestamp, packet);
-        }
-        
-        sizeInWords -= packetSize;
-        rawWords += packetSize;
-    }
+void MIDI2Processor::processBlock(const UMPBlock& block)
+{
+    forEachPacket(block, [this](uint64 ts, UMPView packet) { process(ts, packet); });
 }
@@ -25,6 +25,9 @@
 
 #include "midi2_support.h"
 #include <assert.h>
+#include <stddef.h>
+
+class UMPView;
 
 // -------------------------- UMPacket --------------------------
 
@@ -56,10 +59,73 @@ public:
 	}
 	MessageType;
 	
-	/** @return the message size in bytes, given the message type */
-	static int messageTypeToSize(MessageType mt);
-	
-	static const char* messageTypeToString(MessageType mt);
+	/** packet size in words, indexed by message type */
+	static constexpr byte messageTypeSizes[16] =
+	{
+		/*0*/ 1, /*1*/ 1, /*2*/ 1, /*3*/ 2, /*4*/ 2, /*5*/ 4, /*6*/ 1, /*7*/ 1,
+		/*8*/ 2, /*9*/ 2, /*A*/ 2, /*B*/ 3, /*C*/ 3, /*D*/ 4, /*E*/ 4, /*F*/ 4
+	};
+
+	/** message type names, indexed by message type */
+	static constexpr const char* messageTypeNames[16] =
+	{
+		"Utility", "System", "MIDI1ChannelVoice", "Data64",
+		"MIDI2ChannelVoice", "Data128", "Reserved6", "Reserved7",
+		"Reserved8", "Reserved9", "Reserved10", "Reserved11",
+		"Reserved12", "Reserved13", "Reserved14", "Reserved15"
+	};
+
+	/** @return the message size in words, given the message type */
+	static constexpr int messageTypeToSize(MessageType mt)
+		{ return ((uint)mt < 16) ? messageTypeSizes[mt] : 0; }
+
+	/** @return the message size in words, given the first word of a packet */
+	static constexpr int wordToSize(uint32 word1) { return messageTypeSizes[word1 >> 28]; }
+
+	static constexpr const char* messageTypeToString(MessageType mt)
+		{ return ((uint)mt < 16) ? messageTypeNames[mt] : ""; }
+
+	// Utility Messages
+
+	typedef enum
+	{
+		UtilityStatusNOOP = 0x0,
+		UtilityStatusJRClock = 0x1,
+		UtilityStatusJRTimestamp = 0x2,
+		UtilityStatusDeltaClockstampTPQ = 0x3,
+		UtilityStatusDeltaClockstamp = 0x4
+	}
+	UtilityStatus;
+
+	/** Jitter Reduction clock and timestamps count in units of 1/31250 seconds */
+	static const uint32 JRTicksPerSecond = 31250;
+
+	// Data 64 bit Messages (System Exclusive 7-bit)
+
+	typedef enum
+	{
+		SysEx7StatusComplete = 0x0,
+		SysEx7StatusStart = 0x1,
+		SysEx7StatusContinue = 0x2,
+		SysEx7StatusEnd = 0x3
+	}
+	SysEx7Status;
+
+	/** the maximum number of SysEx bytes in one Data64 packet */
+	static const int SysEx7MaxBytesPerPacket = 6;
+
+	// Data 128 bit Messages (System Exclusive 8-bit and Mixed Data Set)
+
+	typedef enum
+	{
+		Data128StatusSysEx8Complete = 0x0,
+		Data128StatusSysEx8Start = 0x1,
+		Data128StatusSysEx8Continue = 0x2,
+		Data128StatusSysEx8End = 0x3,
+		Data128StatusMixedDataSetHeader = 0x8,
+		Data128StatusMixedDataSetPayload = 0x9
+	}
+	Data128Status;
 
 	// MIDI 1.0 Channel Voice Messages
 
@@ -75,7 +141,16 @@ public:
 	}
 	M1ChannelVoiceStatus;
 
-	static const char* m1ChannelVoiceStatusToString(M1ChannelVoiceStatus status);
+	/** MIDI 1.0 channel voice status names, indexed by status nibble */
+	static constexpr const char* m1ChannelVoiceStatusNames[16] =
+	{
+		"", "", "", "", "", "", "", "",
+		"NoteOff", "NoteOn", "Pressure", "ControlChange",
+		"ProgramChange", "ChannelPressure", "PitchBend", ""
+	};
+
+	static constexpr const char* m1ChannelVoiceStatusToString(M1ChannelVoiceStatus status)
+		{ return ((uint)status < 16) ? m1ChannelVoiceStatusNames[status] : ""; }
 
 
 	// MIDI 2.0 Channel Voice Messages
@@ -101,7 +176,17 @@ public:
 	}
 	M2ChannelVoiceStatus;
 
-	static const char* m2ChannelVoiceStatusToString(M2ChannelVoiceStatus status);
+	/** MIDI 2.0 channel voice status names, indexed by status nibble */
+	static constexpr const char* m2ChannelVoiceStatusNames[16] =
+	{
+		"RegisteredPerNoteCC", "AssignablePerNoteCC", "RegisteredCC", "AssignableCC",
+		"RelativeRegisteredCC", "RelativeAssignableCC", "PerNotePitchBend", "Reserved7",
+		"NoteOff", "NoteOn", "Pressure", "ControlChange",
+		"ProgramChange", "ChannelPressure", "PitchBend", "PerNoteManagement"
+	};
+
+	static constexpr const char* m2ChannelVoiceStatusToString(M2ChannelVoiceStatus status)
+		{ return ((uint)status < 16) ? m2ChannelVoiceStatusNames[status] : ""; }
 
 	
 	typedef enum
@@ -129,7 +214,7 @@ public:
 
 	// ------------------------------------------------------------------
 
-	UMPacket();
+	constexpr UMPacket() : data{ 0, 0, 0, 0 } {}
 
 	/**
 	 * @param sizeInBytes must be 4, 8, 12, or 16 
@@ -141,71 +226,249 @@ public:
 	 * @param count must be 1, 2, or 4
 	 */
 	UMPacket(const uint32* data, int count);
-	UMPacket(uint32 data);
-	UMPacket(uint32 data1, uint32 data2);
-	UMPacket(uint32 data1, uint32 data2, uint32 data3);
-	UMPacket(uint32 data1, uint32 data2, uint32 data3, uint32 data4);
-
-	UMPacket& initNoteOff(uint4 group, uint4 channel, uint7 noteNumber, uint16 velocity);
-	UMPacket& initNoteOff(uint4 group, uint4 channel, uint7 noteNumber, uint16 velocity, uint8 attributeType, uint16 attribute);
-	UMPacket& initNoteOn(uint4 group, uint4 channel, uint7 noteNumber, uint16 velocity);
-	UMPacket& initNoteOn(uint4 group, uint4 channel, uint7 noteNumber, uint16 velocity, uint8 attributeType, uint16 attribute);
-	UMPacket& initPolyPressure(uint4 group, uint4 channel, uint7 noteNumber, uint32 pressure);
-	UMPacket& initControlChange(uint4 group, uint4 channel, uint7 controllerIndex, uint32 value);
-	UMPacket& initAssignableCC(uint4 group, uint4 channel, uint7 bank, uint7 index, uint32 value);
-	UMPacket& initRegisteredCC(uint4 group, uint4 channel, uint7 bank, uint7 index, uint32 value);
-	UMPacket& initProgramChange(uint4 group, uint4 channel, uint8 optionFlags, uint7 program, uint7 bankLSB, uint7 bankMSB);
-	UMPacket& initChannelPressure(uint4 group, uint4 channel, uint32 value);
-	UMPacket& initPitchBend(uint4 group, uint4 channel, uint32 value);
-
-    UMPacket& initPerNoteAssignableCC(uint4 group, uint4 channel, uint7 noteNumber, uint7 index, uint32 value);
-    UMPacket& initPerNoteRegisteredCC(uint4 group, uint4 channel, uint7 noteNumber, uint7 index, uint32 value);
-    UMPacket& initPerNoteManagement(uint4 group, uint4 channel, uint7 noteNumber, uint8 optionFlags/*PerNoteManagementFlag*/);
+	constexpr UMPacket(uint32 data1) : data{ data1, 0, 0, 0 } {}
+	constexpr UMPacket(uint32 data1, uint32 data2) : data{ data1, data2, 0, 0 } {}
+	constexpr UMPacket(uint32 data1, uint32 data2, uint32 data3) : data{ data1, data2, data3, 0 } {}
+	constexpr UMPacket(uint32 data1, uint32 data2, uint32 data3, uint32 data4) : data{ data1, data2, data3, data4 } {}
+
+	/** copy the words of the given view into a new packet */
+	UMPacket(const UMPView& view);
+
+	// Builders: all of them are constexpr, so that packets with constant
+	// arguments can be built at compile time, e.g.:
+	//   constexpr UMPacket allNotesOff = UMPacket().initControlChange(3, 0, MIDI_CC_ALL_NOTES_OFF, 0);
+
+	constexpr UMPacket& initNoteOff(uint4 group, uint4 channel, uint7 noteNumber, uint16 velocity)
+	{
+		setM2ChannelVoice(group, M2StatusNoteOff, channel, (byte)(noteNumber & 0x7F), AttributeNone);
+		setWord(1, velocity, (uint16)0);
+		return *this;
+	}
+
+	constexpr UMPacket& initNoteOff(uint4 group, uint4 channel, uint7 noteNumber, uint16 velocity, uint8 attributeType, uint16 attribute)
+	{
+		setM2ChannelVoice(group, M2StatusNoteOff, channel, (byte)(noteNumber & 0x7F), (byte)(attributeType & 0xFF));
+		setWord(1, velocity, attribute);
+		return *this;
+	}
+
+	constexpr UMPacket& initNoteOn(uint4 group, uint4 channel, uint7 noteNumber, uint16 velocity)
+	{
+		setM2ChannelVoice(group, M2StatusNoteOn, channel, (byte)(noteNumber & 0x7F), AttributeNone);
+		setWord(1, velocity, (uint16)0);
+		return *this;
+	}
+
+	constexpr UMPacket& initNoteOn(uint4 group, uint4 channel, uint7 noteNumber, uint16 velocity, uint8 attributeType, uint16 attribute)
+	{
+		setM2ChannelVoice(group, M2StatusNoteOn, channel, (byte)(noteNumber & 0x7F), (byte)(attributeType & 0xFF));
+		setWord(1, velocity, attribute);
+		return *this;
+	}
+
+	constexpr UMPacket& initPolyPressure(uint4 group, uint4 channel, uint7 noteNumber, uint32 pressure)
+	{
+		setM2ChannelVoice(group, M2StatusPressure, channel, (byte)(noteNumber & 0x7F), 0);
+		setWord(1, pressure);
+		return *this;
+	}
+
+	constexpr UMPacket& initControlChange(uint4 group, uint4 channel, uint7 controllerIndex, uint32 value)
+	{
+		setM2ChannelVoice(group, M2StatusControlChange, channel, (byte)(controllerIndex & 0x7F), 0);
+		setWord(1, value);
+		return *this;
+	}
+
+	constexpr UMPacket& initAssignableCC(uint4 group, uint4 channel, uint7 bank, uint7 index, uint32 value)
+	{
+		setM2ChannelVoice(group, M2StatusAssignableCC, channel, (byte)(bank & 0x7F), (byte)(index & 0x7F));
+		setWord(1, value);
+		return *this;
+	}
+
+	constexpr UMPacket& initRegisteredCC(uint4 group, uint4 channel, uint7 bank, uint7 index, uint32 value)
+	{
+		setM2ChannelVoice(group, M2StatusRegisteredCC, channel, (byte)(bank & 0x7F), (byte)(index & 0x7F));
+		setWord(1, value);
+		return *this;
+	}
+
+	constexpr UMPacket& initProgramChange(uint4 group, uint4 channel, uint8 optionFlags, uint7 program, uint7 bankLSB, uint7 bankMSB)
+	{
+		setM2ChannelVoice(group, M2StatusProgramChange, channel, 0, optionFlags);
+		setWord(1, (byte)(program & 0x7F), (byte)0, (byte)(bankMSB & 0x7F), (byte)(bankLSB & 0x7F));
+		return *this;
+	}
+
+	constexpr UMPacket& initChannelPressure(uint4 group, uint4 channel, uint32 value)
+	{
+		setM2ChannelVoice(group, M2StatusChannelPressure, channel, 0, 0);
+		setWord(1, value);
+		return *this;
+	}
+
+	constexpr UMPacket& initPitchBend(uint4 group, uint4 channel, uint32 value)
+	{
+		setM2ChannelVoice(group, M2StatusPitchBend, channel, 0, 0);
+		setWord(1, value);
+		return *this;
+	}
+
+	constexpr UMPacket& initPerNoteAssignableCC(uint4 group, uint4 channel, uint7 noteNumber, uint7 index, uint32 value)
+	{
+		setM2ChannelVoice(group, M2StatusAssignablePerNoteCC, channel, (byte)(noteNumber & 0x7F), (byte)(index & 0x7F));
+		setWord(1, value);
+		return *this;
+	}
+
+	constexpr UMPacket& initPerNoteRegisteredCC(uint4 group, uint4 channel, uint7 noteNumber, uint7 index, uint32 value)
+	{
+		setM2ChannelVoice(group, M2StatusRegisteredPerNoteCC, channel, (byte)(noteNumber & 0x7F), (byte)(index & 0x7F));
+		setWord(1, value);
+		return *this;
+	}
+
+	constexpr UMPacket& initPerNoteManagement(uint4 group, uint4 channel, uint7 noteNumber, uint8 optionFlags/*PerNoteManagementFlag*/)
+	{
+		setM2ChannelVoice(group, M2StatusPerNoteManagement, channel, (byte)(noteNumber & 0x7F), optionFlags);
+		setWord(1, (uint32)0);
+		return *this;
+	}
+
+	/** @param senderClockTime the sender's current time in JR ticks (1/31250s) */
+	constexpr UMPacket& initJRClock(uint4 group, uint16 senderClockTime)
+	{
+		setUtility(group, UtilityStatusJRClock, senderClockTime);
+		return *this;
+	}
+
+	/** @param timestamp the time of the following message(s) in JR ticks (1/31250s) */
+	constexpr UMPacket& initJRTimestamp(uint4 group, uint16 timestamp)
+	{
+		setUtility(group, UtilityStatusJRTimestamp, timestamp);
+		return *this;
+	}
+
+	/** @param ticksPerQuarterNote the unit of following Delta Clockstamps */
+	constexpr UMPacket& initDeltaClockstampTPQ(uint16 ticksPerQuarterNote)
+	{
+		setUtility(0, UtilityStatusDeltaClockstampTPQ, ticksPerQuarterNote);
+		return *this;
+	}
+
+	/** @param ticks the time since the previous Delta Clockstamp (0..0xFFFFF) */
+	constexpr UMPacket& initDeltaClockstamp(uint32 ticks)
+	{
+		data[0] = (((uint32)Utility) << 28)
+			| (((uint32)UtilityStatusDeltaClockstamp) << 20)
+			| (ticks & 0xFFFFF);
+		return *this;
+	}
+
+	/**
+	 * @param bytes the SysEx data bytes, without F0 and F7
+	 * @param byteCount 0..6
+	 */
+	constexpr UMPacket& initSysEx7(uint4 group, SysEx7Status status, const byte* bytes, int byteCount)
+	{
+		if (byteCount > SysEx7MaxBytesPerPacket) byteCount = SysEx7MaxBytesPerPacket;
+		if (byteCount < 0) byteCount = 0;
+		byte b[SysEx7MaxBytesPerPacket] = { 0, 0, 0, 0, 0, 0 };
+		for (int i = 0; i < byteCount; i++) b[i] = bytes[i] & 0x7F;
+		data[0] = (((uint32)Data64) << 28)
+			| (((uint32)group & 0x0F) << 24)
+			| (((uint32)status & 0x0F) << 20)
+			| (((uint32)byteCount) << 16)
+			| (((uint32)b[0]) << 8)
+			| ((uint32)b[1]);
+		setWord(1, b[2], b[3], b[4], b[5]);
+		return *this;
+	}
 
 	// raw data
 
 	/** @return the size in words (1, 2, 3, or 4) */
-	int getSizeInWords() const { return messageTypeToSize(getMessageType()); }
+	constexpr int getSizeInWords() const { return wordToSize(data[0]); }
 
-	const uint32* getData() const { return data; }
+	constexpr const uint32* getData() const { return data; }
 
 	/** @return the 1st data word */
-	uint32 getWord1() const { return data[0]; }
+	constexpr uint32 getWord1() const { return data[0]; }
 	/** @return the 2nd data word if size is 64, 96, or 128 bit */
-	uint32 getWord2() const { return data[1]; }
+	constexpr uint32 getWord2() const { return data[1]; }
 	/** @return the 3rd data word if size is 96 or 128 bit */
-	uint32 getWord3() const { return data[2]; }
+	constexpr uint32 getWord3() const { return data[2]; }
 	/** @return the 4th data word if size is 128 bit */
-	uint32 getWord4() const { return data[3]; }
+	constexpr uint32 getWord4() const { return data[3]; }
 	
 	/** @return the data word with the given index */
-	uint32 getWord(uint index) const { assert(index < 4); return data[index]; }
-	uint16 getWordUInt16_1(uint index) const { assert(index < 4); return (uint16)(data[index] >> 16); }
-	uint16 getWordUInt16_2(uint index) const { assert(index < 4); return (uint16)(data[index] & 0xFFFF); }
-	byte getWordByte1(uint index) const { assert(index < 4); return (byte)((data[index] >> 24) & 0xFF); }
-	byte getWordByte2(uint index) const { assert(index < 4); return (byte)((data[index] >> 16) & 0xFF); }
-	byte getWordByte3(uint index) const { assert(index < 4); return (byte)((data[index] >> 8) & 0xFF); }
-	byte getWordByte4(uint index) const { assert(index < 4); return (byte)(data[index] & 0xFF); }
+	constexpr uint32 getWord(uint index) const { assert(index < 4); return data[index]; }
+	constexpr uint16 getWordUInt16_1(uint index) const { assert(index < 4); return (uint16)(data[index] >> 16); }
+	constexpr uint16 getWordUInt16_2(uint index) const { assert(index < 4); return (uint16)(data[index] & 0xFFFF); }
+	constexpr byte getWordByte1(uint index) const { assert(index < 4); return (byte)((data[index] >> 24) & 0xFF); }
+	constexpr byte getWordByte2(uint index) const { assert(index < 4); return (byte)((data[index] >> 16) & 0xFF); }
+	constexpr byte getWordByte3(uint index) const { assert(index < 4); return (byte)((data[index] >> 8) & 0xFF); }
+	constexpr byte getWordByte4(uint index) const { assert(index < 4); return (byte)(data[index] & 0xFF); }
 
 	// set data
 
-	void setWord(uint index, uint32 w) { assert(index < 4); data[index] = w; }
-	void setWord(uint index, uint16 a1, uint16 a2)
+	constexpr void setWord(uint index, uint32 w) { assert(index < 4); data[index] = w; }
+	constexpr void setWord(uint index, uint16 a1, uint16 a2)
 	    { assert(index < 4); data[index] = (a1 << 16) | a2; }
-	void setWord(uint index, byte a1, byte a2, byte a3, byte a4)
+	constexpr void setWord(uint index, byte a1, byte a2, byte a3, byte a4)
 	    { assert(index < 4); data[index] = (a1 << 24) | (a2 << 16) | (a3 << 8) | a4; }
 
 	// common fields
 
-	MessageType getMessageType() const { return (MessageType)(data[0] >> 28); }
+	constexpr MessageType getMessageType() const { return (MessageType)(data[0] >> 28); }
 	
-	uint4 getGroup() const { return (uint4)((data[0] >> 24) & 0x0F); }
-	void setGroup(uint4 group) { data[0] = (data[0] & 0xF0FFFFFF) | ((group & 0x0F) << 24); }
+	constexpr uint4 getGroup() const { return (uint4)((data[0] >> 24) & 0x0F); }
+	constexpr void setGroup(uint4 group) { data[0] = (data[0] & 0xF0FFFFFF) | ((group & 0x0F) << 24); }
+
+
+	// Utility Messages
+
+	constexpr void setUtility(uint4 group, UtilityStatus status, uint16 time)
+	{
+		data[0] = (((uint32)Utility) << 28)
+			| (((uint32)group & 0x0F) << 24)
+			| (((uint32)status & 0x0F) << 20)
+			| (uint32)time;
+	}
+
+	constexpr UtilityStatus getUtilityStatus() const { return (UtilityStatus)((data[0] >> 20) & 0x0F); }
+
+	/** @return the JR Clock time or JR Timestamp */
+	constexpr uint16 getJRTime() const { return (uint16)(data[0] & 0xFFFF); }
+
+	/** @return the ticks of a Delta Clockstamp, or the ticks per quarter note of a DCTPQ message */
+	constexpr uint32 getDeltaClockstamp() const
+		{ return data[0] & (getUtilityStatus() == UtilityStatusDeltaClockstamp ? 0xFFFFF : 0xFFFF); }
+
+
+	// Data 64 bit Messages (System Exclusive 7-bit)
+
+	constexpr SysEx7Status getSysEx7Status() const { return (SysEx7Status)((data[0] >> 20) & 0x0F); }
+	/** @return the number of valid SysEx bytes in this packet (0..6) */
+	constexpr int getSysEx7ByteCount() const { return (int)((data[0] >> 16) & 0x0F); }
+	/** @return the SysEx data byte with the given index (0..5) */
+	constexpr byte getSysEx7Byte(int index) const
+		{ return (byte)((data[(index + 2) >> 2] >> (8 * (3 - ((index + 2) & 3)))) & 0x7F); }
+
+
+	// Data 128 bit Messages (System Exclusive 8-bit and Mixed Data Set)
+
+	constexpr Data128Status getData128Status() const { return (Data128Status)((data[0] >> 20) & 0x0F); }
+
+	/** @return the byte at the given position (0..15) of the packet, byte 0 being the MSB of word 1 */
+	constexpr byte getPacketByte(int position) const
+		{ return (byte)((data[position >> 2] >> (8 * (3 - (position & 3)))) & 0xFF); }
 
 
 	// MIDI 1.0 Channel Voice Messages
 
-	void setM1ChannelVoice(uint4 group, M1ChannelVoiceStatus status, uint4 channel, uint7 dataByte1, uint7 dataByte2)
+	constexpr void setM1ChannelVoice(uint4 group, M1ChannelVoiceStatus status, uint4 channel, uint7 dataByte1, uint7 dataByte2)
 	{
 		data[0] = (((uint32)M1ChannelVoice) << 28)
 			| (((uint32)group & 0x0F) << 24)
@@ -215,19 +478,19 @@ public:
 			| ((uint32)dataByte2 & 0x7F);
 	}
 
-	M1ChannelVoiceStatus getM1Status() const { return (M1ChannelVoiceStatus)((data[0] >> 20) & 0x0F); }
-	void setM1Status(M1ChannelVoiceStatus status) { data[0] = (data[0] & 0xFF0FFFFF) | ((status & 0x0F) << 20); }
+	constexpr M1ChannelVoiceStatus getM1Status() const { return (M1ChannelVoiceStatus)((data[0] >> 20) & 0x0F); }
+	constexpr void setM1Status(M1ChannelVoiceStatus status) { data[0] = (data[0] & 0xFF0FFFFF) | ((status & 0x0F) << 20); }
 
-	uint4 getM1Channel() const { return getM2Channel(); }
-	void setM1Channel(uint4 channel) { setM2Channel(channel); }
+	constexpr uint4 getM1Channel() const { return getM2Channel(); }
+	constexpr void setM1Channel(uint4 channel) { setM2Channel(channel); }
 
-	uint7 getM1NoteNumber() const { return getM2NoteNumber(); }
-	void setM1NoteNumber(uint7 noteNumber) { setM2NoteNumber(noteNumber); }
+	constexpr uint7 getM1NoteNumber() const { return getM2NoteNumber(); }
+	constexpr void setM1NoteNumber(uint7 noteNumber) { setM2NoteNumber(noteNumber); }
 
 
 	// MIDI 2.0 Channel Voice Messages
 
-	void setM2ChannelVoice(uint4 group, M2ChannelVoiceStatus status, uint4 channel, uint8 dataByte1, uint8 dataByte2)
+	constexpr void setM2ChannelVoice(uint4 group, M2ChannelVoiceStatus status, uint4 channel, uint8 dataByte1, uint8 dataByte2)
 	{
 		data[0] = (((uint32)M2ChannelVoice) << 28)
 			| (((uint32)group & 0x0F) << 24)
@@ -237,23 +500,206 @@ public:
 			| ((uint32)dataByte2);
 	}
 
-	M2ChannelVoiceStatus getM2Status() const { return (M2ChannelVoiceStatus)((data[0] >> 20) & 0x0F); }
-	void setM2Status(M2ChannelVoiceStatus status) { data[0] = (data[0] & 0xFF0FFFFF) | ((status & 0x0F) << 20); }
+	constexpr M2ChannelVoiceStatus getM2Status() const { return (M2ChannelVoiceStatus)((data[0] >> 20) & 0x0F); }
+	constexpr void setM2Status(M2ChannelVoiceStatus status) { data[0] = (data[0] & 0xFF0FFFFF) | ((status & 0x0F) << 20); }
 
-	uint4 getM2Channel() const { return (uint4)((data[0] >> 16) & 0x0F); }
-	void setM2Channel(uint4 channel) { data[0] = (data[0] & 0xFFF0FFFF) | ((channel & 0x0F) << 16); }
+	constexpr uint4 getM2Channel() const { return (uint4)((data[0] >> 16) & 0x0F); }
+	constexpr void setM2Channel(uint4 channel) { data[0] = (data[0] & 0xFFF0FFFF) | ((channel & 0x0F) << 16); }
 
-	uint7 getM2NoteNumber() const { return (uint7)((data[0] >> 8) & 0x7F); }
-	void setM2NoteNumber(uint7 noteNumber) { data[0] = (data[0] & 0xFFFF00FF) | ((noteNumber & 0x7F) << 8); }
+	constexpr uint7 getM2NoteNumber() const { return (uint7)((data[0] >> 8) & 0x7F); }
+	constexpr void setM2NoteNumber(uint7 noteNumber) { data[0] = (data[0] & 0xFFFF00FF) | ((noteNumber & 0x7F) << 8); }
 
 	// Debugging
 
+	/** a buffer of this size is always large enough for format() */
+	static const int MaxFormattedLength = 128;
+
+	/**
+	 * Write a human-readable version of this packet, the same as toString().
+	 * Thread-safe, without allocation, and much faster than sprintf.
+	 * The output is truncated to size - 1 characters and always 0-terminated.
+	 * @return the number of characters written, without the terminating 0
+	 */
+	int format(char* buffer, size_t size) const;
+
+	/** @return the formatted packet in a per-thread buffer, valid until the next call */
 	const char* toString() const;
 private:
 	uint32 data[4];
 };
 
 
+// -------------------------- UMPView --------------------------
+
+/**
+ * A non-owning, read-only view onto one UMP packet inside a word buffer.
+ * The accessors are the same as the ones of UMPacket, but no data is copied.
+ * The view is only valid as long as the underlying buffer is.
+ */
+class UMPView
+{
+public:
+	UMPView() : data(nullptr), size(0) {}
+
+	/**
+	 * @param words must point to at least sizeInWords words
+	 * @param sizeInWords 1, 2, 3, or 4
+	 */
+	UMPView(const uint32* words, int sizeInWords) : data(words), size(sizeInWords) {}
+
+	/** view onto the given packet, which must outlive this view */
+	UMPView(const UMPacket& packet) : data(packet.getData()), size(packet.getSizeInWords()) {}
+
+	bool isValid() const { return data != nullptr && size > 0; }
+
+	// raw data
+
+	/** @return the size in words (1, 2, 3, or 4) */
+	int getSizeInWords() const { return size; }
+
+	const uint32* getData() const { return data; }
+
+	uint32 getWord1() const { return data[0]; }
+	uint32 getWord2() const { return data[1]; }
+	uint32 getWord3() const { return data[2]; }
+	uint32 getWord4() const { return data[3]; }
+
+	uint32 getWord(uint index) const { assert((int)index < size); return data[index]; }
+	uint16 getWordUInt16_1(uint index) const { assert((int)index < size); return (uint16)(data[index] >> 16); }
+	uint16 getWordUInt16_2(uint index) const { assert((int)index < size); return (uint16)(data[index] & 0xFFFF); }
+	byte getWordByte1(uint index) const { assert((int)index < size); return (byte)((data[index] >> 24) & 0xFF); }
+	byte getWordByte2(uint index) const { assert((int)index < size); return (byte)((data[index] >> 16) & 0xFF); }
+	byte getWordByte3(uint index) const { assert((int)index < size); return (byte)((data[index] >> 8) & 0xFF); }
+	byte getWordByte4(uint index) const { assert((int)index < size); return (byte)(data[index] & 0xFF); }
+
+	// common fields
+
+	UMPacket::MessageType getMessageType() const { return (UMPacket::MessageType)(data[0] >> 28); }
+	uint4 getGroup() const { return (uint4)((data[0] >> 24) & 0x0F); }
+
+	// Utility Messages
+
+	UMPacket::UtilityStatus getUtilityStatus() const { return (UMPacket::UtilityStatus)((data[0] >> 20) & 0x0F); }
+	uint16 getJRTime() const { return (uint16)(data[0] & 0xFFFF); }
+	uint32 getDeltaClockstamp() const
+		{ return data[0] & (getUtilityStatus() == UMPacket::UtilityStatusDeltaClockstamp ? 0xFFFFF : 0xFFFF); }
+
+	// Data 64 bit Messages (System Exclusive 7-bit)
+
+	UMPacket::SysEx7Status getSysEx7Status() const { return (UMPacket::SysEx7Status)((data[0] >> 20) & 0x0F); }
+	int getSysEx7ByteCount() const { return (int)((data[0] >> 16) & 0x0F); }
+	byte getSysEx7Byte(int index) const
+		{ return (byte)((data[(index + 2) >> 2] >> (8 * (3 - ((index + 2) & 3)))) & 0x7F); }
+
+	// Data 128 bit Messages (System Exclusive 8-bit and Mixed Data Set)
+
+	UMPacket::Data128Status getData128Status() const { return (UMPacket::Data128Status)((data[0] >> 20) & 0x0F); }
+	byte getPacketByte(int position) const
+		{ assert((position >> 2) < size); return (byte)((data[position >> 2] >> (8 * (3 - (position & 3)))) & 0xFF); }
+
+	// MIDI 1.0 Channel Voice Messages
+
+	UMPacket::M1ChannelVoiceStatus getM1Status() const { return (UMPacket::M1ChannelVoiceStatus)((data[0] >> 20) & 0x0F); }
+	uint4 getM1Channel() const { return getM2Channel(); }
+	uint7 getM1NoteNumber() const { return getM2NoteNumber(); }
+
+	// MIDI 2.0 Channel Voice Messages
+
+	UMPacket::M2ChannelVoiceStatus getM2Status() const { return (UMPacket::M2ChannelVoiceStatus)((data[0] >> 20) & 0x0F); }
+	uint4 getM2Channel() const { return (uint4)((data[0] >> 16) & 0x0F); }
+	uint7 getM2NoteNumber() const { return (uint7)((data[0] >> 8) & 0x7F); }
+
+private:
+	const uint32* data;
+	int size;
+};
+
+
+// -------------------------- UMPBlock --------------------------
+
+/**
+ * A contiguous series of UMP packets with one timestamp per packet.
+ * Like UMPView, UMPBlock does not own the words or timestamps.
+ */
+class UMPBlock
+{
+public:
+	/**
+	 * @param words the raw packet words
+	 * @param sizeInWords the number of words in words
+	 * @param timestamps one timestamp per packet
+	 * @param packetCount the number of packets in words
+	 */
+	UMPBlock(const uint32* words, int sizeInWords, const uint64* timestamps, int packetCount)
+		: words(words), sizeInWords(sizeInWords), timestamps(timestamps), packetCount(packetCount), timestamp(0) {}
+
+	/** a block where all packets share the same timestamp */
+	UMPBlock(const uint32* words, int sizeInWords, uint64 timestamp)
+		: words(words), sizeInWords(sizeInWords), timestamps(nullptr), packetCount(-1), timestamp(timestamp) {}
+
+	const uint32* getWords() const { return words; }
+	int getSizeInWords() const { return sizeInWords; }
+
+	/** @return the number of packets, or -1 if unknown (shared timestamp) */
+	int getPacketCount() const { return packetCount; }
+
+	/** @return the timestamp of the packet with the given index */
+	uint64 getTimestamp(int packetIndex) const
+	{
+		if (timestamps == nullptr) return timestamp;
+		assert(packetIndex < packetCount);
+		return timestamps[packetIndex];
+	}
+
+	/** @return a block with only the first packetCount packets, which take sizeInWords words */
+	UMPBlock getHead(int headSizeInWords, int headPacketCount) const
+	{
+		if (timestamps == nullptr) return UMPBlock(words, headSizeInWords, timestamp);
+		return UMPBlock(words, headSizeInWords, timestamps, headPacketCount);
+	}
+
+private:
+	const uint32* words;
+	int sizeInWords;
+	const uint64* timestamps;
+	int packetCount;
+	uint64 timestamp;
+};
+
+
+/**
+ * A fixed-size buffer for collecting packets with their timestamps,
+ * to be passed on as one UMPBlock. Does not allocate.
+ */
+class UMPBlockBuffer
+{
+public:
+	static const int MaxWords = 256;
+
+	UMPBlockBuffer() : sizeInWords(0), packetCount(0) {}
+
+	/**
+	 * Append whole packets from the raw words, all with the given timestamp.
+	 * Stops when the buffer is full or at an incomplete trailing packet.
+	 * @param incomplete if not null, set to true if it stopped at an
+	 *        incomplete trailing packet, and to false otherwise
+	 * @return the number of words consumed
+	 */
+	int add(uint64 timestamp, const uint32* rawWords, int rawSizeInWords, bool* incomplete = nullptr);
+
+	void clear() { sizeInWords = 0; packetCount = 0; }
+	bool isEmpty() const { return packetCount == 0; }
+
+	UMPBlock getBlock() const { return UMPBlock(words, sizeInWords, timestamps, packetCount); }
+
+private:
+	uint32 words[MaxWords];
+	uint64 timestamps[MaxWords];
+	int sizeInWords;
+	int packetCount;
+};
+
+
 //
 // ----------- MIDI2Processor (base class) -----------
 //
@@ -265,10 +711,150 @@ public:
     /** abstract process() method, to be implemented by subclasses */
     virtual void process(uint64 timestamp, const UMPacket& packet) = 0;
 
-    /** wrapper for process(), taking a series of raw UMP packet words */
+    /**
+     * process a packet in place, without copying it.
+     * The default implementation copies the view into a UMPacket and calls process() above.
+     * Override this method to avoid the copy.
+     */
+    virtual void process(uint64 timestamp, UMPView packet);
+
+    /** wrapper for process(UMPView), taking a series of raw UMP packet words */
     virtual void processRawUMP(uint64 timestamp, const uint32* rawWords, int sizeInWords);
+
+    /**
+     * process a whole block of packets with one virtual call.
+     * The default implementation calls process(UMPView) for every packet.
+     */
+    virtual void processBlock(const UMPBlock& block);
     
     /** optional error handler */
     virtual void onCorruptRawData(const char* errorMessage) {}
-    
+
+protected:
+    /**
+     * Call handler(timestamp, UMPView) for every complete packet in the raw words.
+     * An incomplete packet at the end is reported to onCorruptRawData().
+     * @return the number of words in complete packets
+     */
+    template<class Handler>
+    int forEachPacket(uint64 timestamp, const uint32* rawWords, int sizeInWords, Handler&& handler)
+    {
+        int pos = forEachCompletePacket(timestamp, rawWords, sizeInWords, handler);
+        if (pos < sizeInWords && rawWords != nullptr)
+        {
+            onCorruptRawData("incomplete UMP received.");
+        }
+        return pos;
+    }
+
+    /** like above, with the timestamp of every packet taken from the block */
+    template<class Handler>
+    int forEachPacket(const UMPBlock& block, Handler&& handler)
+    {
+        int packetCount = 0;
+        int pos = forEachCompletePacket(block, handler, &packetCount);
+        if (pos < block.getSizeInWords() && block.getWords() != nullptr)
+        {
+            onCorruptRawData("incomplete UMP received.");
+        }
+        return pos;
+    }
+
+    /**
+     * For pass-through processors: call handler(timestamp, UMPView) for every
+     * complete packet, pass all complete packets on to downstream (can be null)
+     * with one call, and only then report an incomplete packet at the end to
+     * onCorruptRawData(), so that packets and errors stay in order.
+     */
+    template<class Handler>
+    void passRawUMP(MIDI2Processor* downstream, uint64 timestamp, const uint32* rawWords, int sizeInWords, Handler&& handler)
+    {
+        int pos = forEachCompletePacket(timestamp, rawWords, sizeInWords, handler);
+        if (downstream != nullptr && pos > 0)
+        {
+            downstream->processRawUMP(timestamp, rawWords, pos);
+        }
+        if (pos < sizeInWords && rawWords != nullptr)
+        {
+            onCorruptRawData("incomplete UMP received.");
+        }
+    }
+
+    /** like above, passing on the complete packets of the block as one block */
+    template<class Handler>
+    void passBlock(MIDI2Processor* downstream, const UMPBlock& block, Handler&& handler)
+    {
+        int packetCount = 0;
+        int pos = forEachCompletePacket(block, handler, &packetCount);
+        if (downstream != nullptr && pos > 0)
+        {
+            if (pos == block.getSizeInWords())
+            {
+                downstream->processBlock(block);
+            }
+            else
+            {
+                downstream->processBlock(block.getHead(pos, packetCount));
+            }
+        }
+        if (pos < block.getSizeInWords() && block.getWords() != nullptr)
+        {
+            onCorruptRawData("incomplete UMP received.");
+        }
+    }
+
+    /**
+     * Like forEachPacket(), without reporting an incomplete packet at the end.
+     * @return the number of words in complete packets
+     */
+    template<class Handler>
+    static int forEachCompletePacket(uint64 timestamp, const uint32* rawWords, int sizeInWords, Handler&& handler)
+    {
+        if (rawWords == nullptr)
+        {
+            return 0;
+        }
+        int pos = 0;
+        while (pos < sizeInWords)
+        {
+            int packetSize = UMPacket::wordToSize(rawWords[pos]);
+            if (pos + packetSize > sizeInWords)
+            {
+                break;
+            }
+            handler(timestamp, UMPView(rawWords + pos, packetSize));
+            pos += packetSize;
+        }
+        return pos;
+    }
+
+    /** like above, with the timestamp of every packet taken from the block */
+    template<class Handler>
+    static int forEachCompletePacket(const UMPBlock& block, Handler&& handler, int* packetCount = nullptr)
+    {
+        const uint32* rawWords = block.getWords();
+        int sizeInWords = block.getSizeInWords();
+        if (rawWords == nullptr)
+        {
+            return 0;
+        }
+        int pos = 0;
+        int packetIndex = 0;
+        while (pos < sizeInWords)
+        {
+            int packetSize = UMPacket::wordToSize(rawWords[pos]);
+            if (pos + packetSize > sizeInWords)
+            {
+                break;
+            }
+            handler(block.getTimestamp(packetIndex), UMPView(rawWords + pos, packetSize));
+            pos += packetSize;
+            packetIndex++;
+        }
+        if (packetCount != nullptr)
+        {
+            *packetCount = packetIndex;
+        }
+        return pos;
+    }
 };
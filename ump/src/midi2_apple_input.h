@@ -46,6 +46,7 @@ public:
     
 private:
     MIDI2Processor* receiver = nullptr;
+    UMPBlockBuffer blockBuffer;
     MIDIPortRef port = 0;
     MIDIEndpointRef endpoint = 0;
 };
@@ -116,13 +116,45 @@ void MIDI2AppleInput::handleMIDIEventList(const MIDIEventList* eventList)
         return;
     }
 
+    // collect the whole event list into one block, so that the receiver
+    // is called once per event list rather than once per UMP
+    blockBuffer.clear();
     const MIDIEventPacket* packet = eventList->packet;
     for (int index = 0; index < (int)eventList->numPackets; index++)
     {
         if (packet != NULL)
         {
-            receiver->processRawUMP((uint64)packet->timeStamp, (const uint32*)packet->words, (int)packet->wordCount);
+            const uint32* words = (const uint32*)packet->words;
+            int sizeInWords = (int)packet->wordCount;
+            while (sizeInWords > 0)
+            {
+                bool incomplete;
+                int consumed = blockBuffer.add((uint64)packet->timeStamp, words, sizeInWords, &incomplete);
+                if (incomplete)
+                {
+                    // deliver the complete packets before it first, to keep the order of packets and errors
+                    if (!blockBuffer.isEmpty())
+                    {
+                        receiver->processBlock(blockBuffer.getBlock());
+                        blockBuffer.clear();
+                    }
+                    receiver->onCorruptRawData("incomplete UMP received.");
+                    break;
+                }
+                if (consumed < sizeInWords)
+                {
+                    // block is full
+                    receiver->processBlock(blockBuffer.getBlock());
+                    blockBuffer.clear();
+                }
+                words += consumed;
+                sizeInWords -= consumed;
+            }
         }
         packet = MIDIEventPacketNext(packet);
     }
+    if (!blockBuffer.isEmpty())
+    {
+        receiver->processBlock(blockBuffer.getBlock());
+    }
 }
@@ -46,6 +46,9 @@ public:
     
     bool send(const UMPacket& packet, uint64 timestamp = 0);
 
+    /** send a series of raw UMP packet words, e.g. from MIDI2SysEx7Encoder */
+    bool send(const uint32* words, int sizeInWords, uint64 timestamp = 0);
+
 private:
     MIDIPortRef port = 0;
     MIDIEndpointRef endpoint = 0;
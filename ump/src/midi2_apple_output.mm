@@ -149,3 +149,54 @@ bool MIDI2AppleOutput::send(const UMPacket& packet, uint64 timestamp /* = 0 */)
     }
     return true;
 }
+
+
+bool MIDI2AppleOutput::send(const uint32* words, int sizeInWords, uint64 timestamp /* = 0 */)
+{
+    // eventList contains space for up to 64 words: send in chunks of whole packets
+    const int maxChunkWords = 64;
+    while (sizeInWords > 0)
+    {
+        int chunkWords = 0;
+        while (chunkWords < sizeInWords)
+        {
+            int packetSize = UMPacket::wordToSize(words[chunkWords]);
+            if (chunkWords + packetSize > maxChunkWords || chunkWords + packetSize > sizeInWords)
+            {
+                break;
+            }
+            chunkWords += packetSize;
+        }
+        if (chunkWords == 0)
+        {
+            PRINT1("ERROR: incomplete UMP, cannot send.");
+            return false;
+        }
+
+        MIDIEventList eventList;
+        MIDIEventPacket* curPacket = MIDIEventListInit(&eventList, kMIDIProtocol_2_0);
+        curPacket = MIDIEventListAdd(&eventList,
+                                     sizeof(eventList),
+                                     curPacket,
+                                     (MIDITimeStamp)timestamp,
+                                     chunkWords,
+                                     (const UInt32*)words);
+        OSStatus result;
+        if (isVirtual)
+        {
+            result = MIDIReceivedEventList(endpoint, &eventList);
+        }
+        else
+        {
+            result = MIDISendEventList(port, endpoint, &eventList);
+        }
+        if (result != noErr)
+        {
+            PRINT1("ERROR: cannot send UMP to endpoint.");
+            return false;
+        }
+        words += chunkWords;
+        sizeInWords -= chunkWords;
+    }
+    return true;
+}
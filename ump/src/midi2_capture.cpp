@@ -0,0 +1,572 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "midi2_capture.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace MIDI2Capture;
+
+// number of chunks written to the file at once
+#define CAPTURE_CHUNKS_PER_WRITE  (16)
+// alignment of buffers and file offsets for direct I/O
+#define CAPTURE_ALIGNMENT         (4096)
+
+// maximum number of payload words in a chunk
+static const int ChunkPayloadWords = ChunkSizeInWords - (int)(sizeof(ChunkHeader) / 4);
+
+
+static size_t roundUpToAlignment(size_t size)
+{
+    return (size + CAPTURE_ALIGNMENT - 1) & ~(size_t)(CAPTURE_ALIGNMENT - 1);
+}
+
+
+//
+// MARK: MIDI2CaptureWriter
+//
+
+MIDI2CaptureWriter::MIDI2CaptureWriter()
+    : MIDI2Processor()
+    , fd(-1)
+    , error(false)
+    , buffer(nullptr)
+    , bufferedChunks(0)
+    , chunk(nullptr)
+    , chunkWords(nullptr)
+    , chunkBytes(0)
+    , fileOffset(0)
+    , packetCount(0)
+    , timestampUnitsPerSecond(0)
+{
+}
+
+
+MIDI2CaptureWriter::~MIDI2CaptureWriter()
+{
+    close();
+}
+
+
+bool MIDI2CaptureWriter::open(const char* path, uint64 _timestampUnitsPerSecond, bool directIO, bool encode)
+{
+    close();
+    if (encode)
+    {
+        encoder.reset(new MIDI2StreamCodec());
+    }
+    else
+    {
+        encoder.reset();
+    }
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#if defined(O_DIRECT)
+    if (directIO)
+    {
+        flags |= O_DIRECT;
+    }
+#endif
+    fd = ::open(path, flags, 0644);
+    if (fd < 0)
+    {
+        return false;
+    }
+#if defined(F_NOCACHE)
+    if (directIO)
+    {
+        fcntl(fd, F_NOCACHE, 1);
+    }
+#endif
+    void* memory = nullptr;
+    if (posix_memalign(&memory, CAPTURE_ALIGNMENT, (size_t)ChunkSize * CAPTURE_CHUNKS_PER_WRITE) != 0)
+    {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    buffer = (byte*)memory;
+    bufferedChunks = 0;
+    chunk = nullptr;
+    error = false;
+    fileOffset = HeaderSize;
+    packetCount = 0;
+    timestampUnitsPerSecond = _timestampUnitsPerSecond;
+    index.clear();
+    if (!writeHeader(0))
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+
+bool MIDI2CaptureWriter::writeHeader(uint64 indexOffset)
+{
+    FileHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = FileMagic;
+    header.version = Version;
+    header.headerSize = HeaderSize;
+    header.chunkSize = ChunkSize;
+    header.timestampUnitsPerSecond = timestampUnitsPerSecond;
+    header.indexOffset = indexOffset;
+    header.chunkCount = index.size();
+    header.packetCount = packetCount;
+    return writeAligned(&header, sizeof(header), 0);
+}
+
+
+void MIDI2CaptureWriter::startChunk(uint64 timestamp)
+{
+    if (bufferedChunks == CAPTURE_CHUNKS_PER_WRITE)
+    {
+        writeBuffer();
+    }
+    chunk = (ChunkHeader*)(buffer + (size_t)bufferedChunks * ChunkSize);
+    chunk->magic = ChunkMagic;
+    chunk->packetCount = 0;
+    chunk->sizeInWords = 0;
+    chunk->flags = encoder ? ChunkFlagEncoded : 0;
+    chunk->firstTimestamp = timestamp;
+    chunk->lastTimestamp = timestamp;
+    chunkWords = (uint32*)(chunk + 1);
+    chunkBytes = 0;
+    if (encoder)
+    {
+        encoder->reset(timestamp);
+    }
+}
+
+
+void MIDI2CaptureWriter::finishChunk()
+{
+    if (chunk == nullptr)
+    {
+        return;
+    }
+    if (encoder)
+    {
+        chunk->sizeInWords = (uint32)((chunkBytes + 3) / 4);
+        memset((byte*)chunkWords + chunkBytes, 0, (size_t)ChunkPayloadWords * 4 - (size_t)chunkBytes);
+    }
+    else
+    {
+        memset(chunkWords + chunk->sizeInWords, 0, (size_t)(ChunkPayloadWords - chunk->sizeInWords) * 4);
+    }
+
+    IndexEntry entry;
+    entry.fileOffset = fileOffset + (uint64)bufferedChunks * ChunkSize;
+    entry.firstTimestamp = chunk->firstTimestamp;
+    entry.lastTimestamp = chunk->lastTimestamp;
+    entry.firstPacket = packetCount - chunk->packetCount;
+    index.push_back(entry);
+
+    bufferedChunks++;
+    chunk = nullptr;
+}
+
+
+bool MIDI2CaptureWriter::writeBuffer()
+{
+    size_t bytes = (size_t)bufferedChunks * ChunkSize;
+    if (bytes > 0)
+    {
+        if (pwrite(fd, buffer, bytes, (off_t)fileOffset) != (ssize_t)bytes)
+        {
+            error = true;
+        }
+        fileOffset += bytes;
+    }
+    bufferedChunks = 0;
+    return !error;
+}
+
+
+bool MIDI2CaptureWriter::writeAligned(const void* source, size_t bytes, uint64 offset)
+{
+    // the buffer is not in use anymore when the header and index are written
+    size_t capacity = (size_t)ChunkSize * CAPTURE_CHUNKS_PER_WRITE;
+    const byte* src = (const byte*)source;
+    while (bytes > 0)
+    {
+        size_t n = bytes < capacity ? bytes : capacity;
+        size_t padded = roundUpToAlignment(n);
+        memcpy(buffer, src, n);
+        memset(buffer + n, 0, padded - n);
+        if (pwrite(fd, buffer, padded, (off_t)offset) != (ssize_t)padded)
+        {
+            error = true;
+            return false;
+        }
+        src += n;
+        bytes -= n;
+        offset += padded;
+    }
+    return true;
+}
+
+
+bool MIDI2CaptureWriter::close()
+{
+    if (fd < 0)
+    {
+        return false;
+    }
+    finishChunk();
+    writeBuffer();
+
+    // index
+    uint64 indexOffset = fileOffset;
+    std::vector<byte> indexData(sizeof(IndexHeader) + index.size() * sizeof(IndexEntry));
+    IndexHeader indexHeader;
+    indexHeader.magic = IndexMagic;
+    indexHeader.reserved = 0;
+    indexHeader.chunkCount = index.size();
+    memcpy(indexData.data(), &indexHeader, sizeof(indexHeader));
+    if (!index.empty())
+    {
+        memcpy(indexData.data() + sizeof(indexHeader), index.data(), index.size() * sizeof(IndexEntry));
+    }
+    writeAligned(indexData.data(), indexData.size(), indexOffset);
+
+    // header, written last so that the index is only used when complete
+    writeHeader(error ? 0 : indexOffset);
+
+    ::close(fd);
+    fd = -1;
+    free(buffer);
+    buffer = nullptr;
+    chunk = nullptr;
+    index.clear();
+    return !error;
+}
+
+
+void MIDI2CaptureWriter::process(uint64 timestamp, const UMPacket& packet)
+{
+    process(timestamp, UMPView(packet));
+}
+
+
+void MIDI2CaptureWriter::process(uint64 timestamp, UMPView packet)
+{
+    if (fd < 0)
+    {
+        return;
+    }
+    if (encoder)
+    {
+        if (chunk == nullptr
+            || chunkBytes + MIDI2StreamCodec::MaxEncodedPacketSize > ChunkPayloadWords * 4)
+        {
+            finishChunk();
+            startChunk(timestamp);
+        }
+        chunkBytes += encoder->encode(timestamp, packet, (byte*)chunkWords + chunkBytes,
+                                      ChunkPayloadWords * 4 - chunkBytes);
+        chunk->packetCount++;
+        chunk->lastTimestamp = timestamp;
+        packetCount++;
+        return;
+    }
+    int size = packet.getSizeInWords();
+    if (chunk == nullptr
+        || timestamp < chunk->firstTimestamp
+        || timestamp - chunk->firstTimestamp > 0xFFFFFFFF
+        || (int)chunk->sizeInWords + 1 + size > ChunkPayloadWords)
+    {
+        finishChunk();
+        startChunk(timestamp);
+    }
+    uint32* dest = chunkWords + chunk->sizeInWords;
+    dest[0] = (uint32)(timestamp - chunk->firstTimestamp);
+    const uint32* words = packet.getData();
+    for (int i = 0; i < size; i++)
+    {
+        dest[1 + i] = words[i];
+    }
+    chunk->sizeInWords += 1 + size;
+    chunk->packetCount++;
+    chunk->lastTimestamp = timestamp;
+    packetCount++;
+}
+
+
+//
+// MARK: MIDI2CaptureReader
+//
+
+MIDI2CaptureReader::MIDI2CaptureReader()
+    : data(nullptr)
+    , size(0)
+    , validChunkFlags(0)
+    , packetCount(0)
+    , chunkIndex(0)
+    , words(nullptr)
+    , wordsLeft(0)
+    , chunkTimestamp(0)
+    , encodedData(nullptr)
+    , encodedBytesLeft(0)
+    , encodedPacketsLeft(0)
+{
+}
+
+
+MIDI2CaptureReader::~MIDI2CaptureReader()
+{
+    close();
+}
+
+
+bool MIDI2CaptureReader::open(const char* path)
+{
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < (size_t)HeaderSize)
+    {
+        ::close(fd);
+        return false;
+    }
+    void* mapped = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        return false;
+    }
+    data = (const byte*)mapped;
+    size = (size_t)st.st_size;
+    madvise((void*)data, size, MADV_SEQUENTIAL);
+
+    const FileHeader* header = (const FileHeader*)data;
+    if (header->magic != FileMagic || header->version < 1 || header->version > Version
+        || header->headerSize != (uint32)HeaderSize || header->chunkSize != (uint32)ChunkSize)
+    {
+        close();
+        return false;
+    }
+    // version 1 chunks have a reserved field instead of flags
+    validChunkFlags = header->version >= 2 ? ChunkFlagsKnown : 0;
+
+    // the offsets and counts come from the file: compare without overflow
+    const IndexHeader* indexHeader = nullptr;
+    if (header->indexOffset != 0 && header->indexOffset <= size - sizeof(IndexHeader))
+    {
+        indexHeader = (const IndexHeader*)(data + header->indexOffset);
+        if (indexHeader->magic != IndexMagic
+            || indexHeader->chunkCount > (size - header->indexOffset - sizeof(IndexHeader)) / sizeof(IndexEntry))
+        {
+            indexHeader = nullptr;
+        }
+    }
+    if (indexHeader != nullptr)
+    {
+        const IndexEntry* entries = (const IndexEntry*)(indexHeader + 1);
+        index.assign(entries, entries + indexHeader->chunkCount);
+        packetCount = header->packetCount;
+    }
+    else
+    {
+        // no index: collect the complete chunks
+        packetCount = 0;
+        for (uint64 offset = HeaderSize; offset + ChunkSize <= size; offset += ChunkSize)
+        {
+            const ChunkHeader* chunk = (const ChunkHeader*)(data + offset);
+            if (chunk->magic != ChunkMagic || chunk->sizeInWords > (uint32)ChunkPayloadWords
+                || (chunk->flags & ~validChunkFlags) != 0)
+            {
+                break;
+            }
+            IndexEntry entry;
+            entry.fileOffset = offset;
+            entry.firstTimestamp = chunk->firstTimestamp;
+            entry.lastTimestamp = chunk->lastTimestamp;
+            entry.firstPacket = packetCount;
+            index.push_back(entry);
+            packetCount += chunk->packetCount;
+        }
+    }
+    rewind();
+    return true;
+}
+
+
+void MIDI2CaptureReader::close()
+{
+    if (data != nullptr)
+    {
+        munmap((void*)data, size);
+        data = nullptr;
+        size = 0;
+    }
+    validChunkFlags = 0;
+    index.clear();
+    packetCount = 0;
+    chunkIndex = 0;
+    words = nullptr;
+    wordsLeft = 0;
+    encodedPacketsLeft = 0;
+}
+
+
+uint64 MIDI2CaptureReader::getTimestampUnitsPerSecond() const
+{
+    return data != nullptr ? ((const FileHeader*)data)->timestampUnitsPerSecond : 0;
+}
+
+
+const ChunkHeader* MIDI2CaptureReader::getChunk(int i) const
+{
+    uint64 offset = index[i].fileOffset;
+    if (size < (size_t)ChunkSize || offset > size - ChunkSize)
+    {
+        return nullptr;
+    }
+    const ChunkHeader* chunk = (const ChunkHeader*)(data + offset);
+    if (chunk->magic != ChunkMagic || chunk->sizeInWords > (uint32)ChunkPayloadWords
+        || (chunk->flags & ~validChunkFlags) != 0)
+    {
+        return nullptr;
+    }
+    return chunk;
+}
+
+
+void MIDI2CaptureReader::setChunk(int i)
+{
+    chunkIndex = i;
+    words = nullptr;
+    wordsLeft = 0;
+    encodedPacketsLeft = 0;
+    if (i < getChunkCount())
+    {
+        const ChunkHeader* chunk = getChunk(i);
+        if (chunk != nullptr && (chunk->flags & ChunkFlagEncoded) != 0)
+        {
+            if (!decoder)
+            {
+                decoder.reset(new MIDI2StreamCodec());
+            }
+            decoder->reset(chunk->firstTimestamp);
+            encodedData = (const byte*)(chunk + 1);
+            encodedBytesLeft = (int)chunk->sizeInWords * 4;
+            encodedPacketsLeft = (int)chunk->packetCount;
+        }
+        else if (chunk != nullptr)
+        {
+            words = (const uint32*)(chunk + 1);
+            wordsLeft = (int)chunk->sizeInWords;
+            chunkTimestamp = chunk->firstTimestamp;
+        }
+    }
+}
+
+
+void MIDI2CaptureReader::rewind()
+{
+    setChunk(0);
+}
+
+
+void MIDI2CaptureReader::seek(uint64 timestamp)
+{
+    // first chunk with lastTimestamp >= timestamp
+    int low = 0;
+    int high = getChunkCount();
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+        if (index[mid].lastTimestamp < timestamp)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    setChunk(low);
+}
+
+
+bool MIDI2CaptureReader::next(uint64& timestamp, UMPView& packet)
+{
+    for (;;)
+    {
+        while (wordsLeft == 0 && encodedPacketsLeft == 0)
+        {
+            if (chunkIndex + 1 >= getChunkCount())
+            {
+                return false;
+            }
+            setChunk(chunkIndex + 1);
+        }
+        if (encodedPacketsLeft > 0)
+        {
+            int n = decoder->decode(encodedData, encodedBytesLeft, timestamp, decodedPacket);
+            if (n == 0)
+            {
+                // corrupt chunk: skip the rest of it
+                encodedPacketsLeft = 0;
+                continue;
+            }
+            encodedData += n;
+            encodedBytesLeft -= n;
+            encodedPacketsLeft--;
+            packet = UMPView(decodedPacket);
+            return true;
+        }
+        int packetSize = (wordsLeft >= 2) ? UMPacket::wordToSize(words[1]) : 0;
+        if (packetSize == 0 || 1 + packetSize > wordsLeft)
+        {
+            // corrupt chunk: skip the rest of it
+            wordsLeft = 0;
+            continue;
+        }
+        timestamp = chunkTimestamp + words[0];
+        packet = UMPView(words + 1, packetSize);
+        words += 1 + packetSize;
+        wordsLeft -= 1 + packetSize;
+        return true;
+    }
+}
+
+
+void MIDI2CaptureReader::replay(MIDI2Processor& target)
+{
+    uint64 timestamp;
+    UMPView packet;
+    while (next(timestamp, packet))
+    {
+        target.process(timestamp, packet);
+    }
+}
@@ -0,0 +1,231 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+
+#include "midi2.h"
+#include "midi2_codec.h"
+#include <memory>
+#include <stddef.h>
+#include <vector>
+
+
+/**
+ * Binary capture files of timestamped UMP packets.
+ *
+ * Layout (host byte order, all sizes multiples of 4096 bytes):
+ *  - FileHeader, padded to HeaderSize
+ *  - chunks of ChunkSize bytes each: a ChunkHeader, followed by
+ *    the packets. Every packet is stored as 1 word timestamp delta
+ *    (relative to the chunk's firstTimestamp), followed by its 1..4 words.
+ *    With ChunkFlagEncoded, the packets are encoded by a MIDI2StreamCodec
+ *    instead, reset to the chunk's firstTimestamp.
+ *    The rest of the chunk is padded with zeros.
+ *  - the chunk index: IndexHeader followed by one IndexEntry
+ *    per chunk, padded to a multiple of 4096 bytes.
+ *
+ * The header is written when the capture is opened, and again with the
+ * index offset when it is closed. A file without index (e.g. after a
+ * crash) can still be read up to the last chunk written.
+ */
+namespace MIDI2Capture
+{
+    static const uint32 FileMagic = 0x4D43504D; // "MPCM"
+    static const uint32 ChunkMagic = 0x4B484355; // "UCHK"
+    static const uint32 IndexMagic = 0x58444955; // "UIDX"
+    /** version 2 added ChunkHeader::flags, version 1 files are still read */
+    static const uint32 Version = 2;
+    /** ChunkHeader flag: the payload is encoded by MIDI2StreamCodec */
+    static const uint32 ChunkFlagEncoded = 1;
+    /** all ChunkHeader flags known to this version */
+    static const uint32 ChunkFlagsKnown = ChunkFlagEncoded;
+    static const int HeaderSize = 4096;
+    static const int ChunkSize = 65536;
+    static const int ChunkSizeInWords = ChunkSize / 4;
+
+    struct FileHeader
+    {
+        uint32 magic;
+        uint32 version;
+        uint32 headerSize;
+        uint32 chunkSize;
+        /** number of timestamp units per second, 0 if unknown */
+        uint64 timestampUnitsPerSecond;
+        /** file offset of the index, 0 if the capture was not closed */
+        uint64 indexOffset;
+        uint64 chunkCount;
+        uint64 packetCount;
+    };
+
+    struct ChunkHeader
+    {
+        uint32 magic;
+        uint32 packetCount;
+        /** number of payload words following this header */
+        uint32 sizeInWords;
+        uint32 flags;
+        uint64 firstTimestamp;
+        uint64 lastTimestamp;
+    };
+
+    struct IndexHeader
+    {
+        uint32 magic;
+        uint32 reserved;
+        uint64 chunkCount;
+    };
+
+    struct IndexEntry
+    {
+        uint64 fileOffset;
+        uint64 firstTimestamp;
+        uint64 lastTimestamp;
+        /** number of packets in all previous chunks */
+        uint64 firstPacket;
+    };
+}
+
+
+/**
+ * A processor writing all packets to a capture file.
+ *
+ * Packets are collected in a large buffer and written in multiples of
+ * ChunkSize, from aligned memory, so the file can also be opened with
+ * direct I/O (O_DIRECT on Linux, F_NOCACHE on macOS). Writing is
+ * synchronous, so for real time threads, put a MIDI2PacketQueue in front.
+ */
+class MIDI2CaptureWriter
+    : public MIDI2Processor
+{
+public:
+    MIDI2CaptureWriter();
+    ~MIDI2CaptureWriter();
+
+    /**
+     * Create the capture file, overwriting an existing file.
+     * @param timestampUnitsPerSecond stored in the header for readers
+     * @param directIO bypass the OS file cache
+     * @param encode compress the packets with MIDI2StreamCodec
+     * @return false if the file could not be created
+     */
+    bool open(const char* path, uint64 timestampUnitsPerSecond = 0, bool directIO = false, bool encode = false);
+
+    /** write the remaining packets and the index, and close the file */
+    bool close();
+
+    bool isOpen() const { return fd >= 0; }
+    /** @return true if a write failed since open() */
+    bool hasError() const { return error; }
+    uint64 getPacketCount() const { return packetCount; }
+
+    void process(uint64 timestamp, const UMPacket& packet) override;
+    void process(uint64 timestamp, UMPView packet) override;
+
+private:
+    void startChunk(uint64 timestamp);
+    void finishChunk();
+    bool writeBuffer();
+    bool writeHeader(uint64 indexOffset);
+    /** write size bytes through the aligned buffer at the given offset */
+    bool writeAligned(const void* data, size_t size, uint64 offset);
+
+    int fd;
+    bool error;
+    /** aligned buffer holding ChunksPerWrite chunks */
+    byte* buffer;
+    int bufferedChunks;
+    /** the chunk currently written, or null */
+    MIDI2Capture::ChunkHeader* chunk;
+    uint32* chunkWords;
+    /** used bytes of an encoded chunk */
+    int chunkBytes;
+    /** used if the packets are encoded */
+    std::unique_ptr<MIDI2StreamCodec> encoder;
+    uint64 fileOffset;
+    uint64 packetCount;
+    uint64 timestampUnitsPerSecond;
+    std::vector<MIDI2Capture::IndexEntry> index;
+};
+
+
+/**
+ * Read a capture file by mapping it into memory.
+ * The packets are returned as views into the mapped file, without copying.
+ */
+class MIDI2CaptureReader
+{
+public:
+    MIDI2CaptureReader();
+    ~MIDI2CaptureReader();
+
+    /** @return false if the file cannot be mapped or is not a capture file */
+    bool open(const char* path);
+    void close();
+    bool isOpen() const { return data != nullptr; }
+
+    uint64 getTimestampUnitsPerSecond() const;
+    int getChunkCount() const { return (int)index.size(); }
+    uint64 getPacketCount() const { return packetCount; }
+    const MIDI2Capture::IndexEntry& getIndexEntry(int chunkIndex) const { return index[chunkIndex]; }
+
+    /**
+     * Get the next packet. The view is valid until close(), or for
+     * encoded chunks, until the next call.
+     * @return false at the end of the capture
+     */
+    bool next(uint64& timestamp, UMPView& packet);
+
+    /** continue reading at the first packet */
+    void rewind();
+
+    /**
+     * Continue reading at the first chunk which may contain packets at or
+     * after the timestamp, assuming the capture is in timestamp order.
+     */
+    void seek(uint64 timestamp);
+
+    /** pass all remaining packets on to the target */
+    void replay(MIDI2Processor& target);
+
+private:
+    const MIDI2Capture::ChunkHeader* getChunk(int chunkIndex) const;
+    void setChunk(int chunkIndex);
+
+    const byte* data;
+    size_t size;
+    /** the chunk flags allowed by the file's version */
+    uint32 validChunkFlags;
+    std::vector<MIDI2Capture::IndexEntry> index;
+    uint64 packetCount;
+    // read position
+    int chunkIndex;
+    const uint32* words;
+    int wordsLeft;
+    uint64 chunkTimestamp;
+    // read position in an encoded chunk
+    const byte* encodedData;
+    int encodedBytesLeft;
+    int encodedPacketsLeft;
+    std::unique_ptr<MIDI2StreamCodec> decoder;
+    UMPacket decodedPacket;
+};
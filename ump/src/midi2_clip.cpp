@@ -0,0 +1,451 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "midi2_clip.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace MIDI2Clip;
+
+// number of words collected before writing to the file
+#define CLIP_WRITE_BUFFER_WORDS  (16384)
+// maximum ticks of one Delta Clockstamp
+#define CLIP_MAX_DELTA_TICKS     (0xFFFFF)
+
+
+static uint32 toBigEndian(uint32 word)
+{
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    return word;
+#else
+    return __builtin_bswap32(word);
+#endif
+}
+
+
+//
+// MARK: MIDI2ClipWriter
+//
+
+MIDI2ClipWriter::MIDI2ClipWriter()
+    : MIDI2Processor()
+    , fd(-1)
+    , error(false)
+    , ticksPerQuarterNote(DefaultTicksPerQuarterNote)
+    , tempo(DefaultTempo)
+    , lastTick(0)
+    , hasFirstTimestamp(false)
+    , firstTimestamp(0)
+    , bufferedWords(0)
+{
+}
+
+
+MIDI2ClipWriter::~MIDI2ClipWriter()
+{
+    close();
+}
+
+
+bool MIDI2ClipWriter::open(const char* path, uint16 _ticksPerQuarterNote, uint32 _tempo)
+{
+    close();
+    if (_ticksPerQuarterNote == 0 || _tempo == 0)
+    {
+        return false;
+    }
+    fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        return false;
+    }
+    error = false;
+    ticksPerQuarterNote = _ticksPerQuarterNote;
+    tempo = _tempo;
+    lastTick = 0;
+    hasFirstTimestamp = false;
+    buffer.resize(CLIP_WRITE_BUFFER_WORDS);
+    bufferedWords = 0;
+
+    uint32 signature[2];
+    memcpy(signature, Signature, sizeof(signature));
+    // the signature is bytes, so it is written as is
+    buffer[0] = signature[0];
+    buffer[1] = signature[1];
+    bufferedWords = 2;
+
+    // header
+    UMPacket packet;
+    writeWords(packet.initDeltaClockstampTPQ(ticksPerQuarterNote).getData(), 1);
+    writeDeltaClockstamp(0);
+
+    // start of the sequence, with the initial tempo
+    writeDeltaClockstamp(0);
+    const uint32 startOfClip[4] = { StartOfClip, 0, 0, 0 };
+    writeWords(startOfClip, 4);
+    writeDeltaClockstamp(0);
+    const uint32 setTempo[4] = { SetTempo, tempo, 0, 0 };
+    writeWords(setTempo, 4);
+    return true;
+}
+
+
+bool MIDI2ClipWriter::close()
+{
+    if (fd < 0)
+    {
+        return false;
+    }
+    writeDeltaClockstamp(lastTick);
+    const uint32 endOfClip[4] = { EndOfClip, 0, 0, 0 };
+    writeWords(endOfClip, 4);
+    flush();
+    ::close(fd);
+    fd = -1;
+    buffer.clear();
+    return !error;
+}
+
+
+void MIDI2ClipWriter::writeWords(const uint32* words, int count)
+{
+    if (bufferedWords + count > (int)buffer.size())
+    {
+        flush();
+    }
+    for (int i = 0; i < count; i++)
+    {
+        buffer[bufferedWords++] = toBigEndian(words[i]);
+    }
+}
+
+
+void MIDI2ClipWriter::writeDeltaClockstamp(uint64 tick)
+{
+    uint64 delta = (tick > lastTick) ? tick - lastTick : 0;
+    UMPacket packet;
+    // longer deltas are split into several Delta Clockstamps
+    while (delta > CLIP_MAX_DELTA_TICKS)
+    {
+        writeWords(packet.initDeltaClockstamp(CLIP_MAX_DELTA_TICKS).getData(), 1);
+        delta -= CLIP_MAX_DELTA_TICKS;
+    }
+    writeWords(packet.initDeltaClockstamp((uint32)delta).getData(), 1);
+    if (tick > lastTick)
+    {
+        lastTick = tick;
+    }
+}
+
+
+void MIDI2ClipWriter::flush()
+{
+    size_t bytes = (size_t)bufferedWords * 4;
+    if (bytes > 0 && ::write(fd, buffer.data(), bytes) != (ssize_t)bytes)
+    {
+        error = true;
+    }
+    bufferedWords = 0;
+}
+
+
+void MIDI2ClipWriter::write(uint64 tick, UMPView packet)
+{
+    if (fd < 0)
+    {
+        return;
+    }
+    writeDeltaClockstamp(tick);
+    writeWords(packet.getData(), packet.getSizeInWords());
+}
+
+
+void MIDI2ClipWriter::process(uint64 timestamp, const UMPacket& packet)
+{
+    process(timestamp, UMPView(packet));
+}
+
+
+void MIDI2ClipWriter::process(uint64 timestamp, UMPView packet)
+{
+    if (!hasFirstTimestamp)
+    {
+        firstTimestamp = timestamp;
+        hasFirstTimestamp = true;
+    }
+    uint64 nanos = (timestamp > firstTimestamp) ? timestamp - firstTimestamp : 0;
+    // tempo is in 10ns units per quarter note
+    write(nanos * ticksPerQuarterNote / ((uint64)tempo * 10), packet);
+}
+
+
+//
+// MARK: MIDI2ClipReader
+//
+
+MIDI2ClipReader::MIDI2ClipReader()
+    : data(nullptr)
+    , size(0)
+    , ticksPerQuarterNote(DefaultTicksPerQuarterNote)
+    , lengthInTicks(0)
+    , start()
+    , current()
+    , tick(0)
+{
+}
+
+
+MIDI2ClipReader::~MIDI2ClipReader()
+{
+    close();
+}
+
+
+uint32 MIDI2ClipReader::readWord(size_t offset) const
+{
+    uint32 word;
+    memcpy(&word, data + offset, 4);
+    return toBigEndian(word);
+}
+
+
+uint64 MIDI2ClipReader::toTimestamp(const Position& position) const
+{
+    return position.tempoTimestamp
+        + (position.tick - position.tempoTick) * position.tempo * 10 / ticksPerQuarterNote;
+}
+
+
+bool MIDI2ClipReader::open(const char* path, uint32 indexInterval)
+{
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Signature) + 4)
+    {
+        ::close(fd);
+        return false;
+    }
+    void* mapped = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        return false;
+    }
+    data = (const byte*)mapped;
+    size = (size_t)st.st_size;
+    if (memcmp(data, Signature, sizeof(Signature)) != 0)
+    {
+        close();
+        return false;
+    }
+
+    // header: up to Start of Clip
+    size_t offset = sizeof(Signature);
+    bool started = false;
+    while (offset + 4 <= size && !started)
+    {
+        uint32 word1 = readWord(offset);
+        UMPacket packet(word1);
+        if (packet.getMessageType() == UMPacket::Utility
+            && packet.getUtilityStatus() == UMPacket::UtilityStatusDeltaClockstampTPQ
+            && packet.getDeltaClockstamp() != 0)
+        {
+            ticksPerQuarterNote = (uint16)packet.getDeltaClockstamp();
+        }
+        started = (word1 == StartOfClip);
+        offset += (size_t)UMPacket::wordToSize(word1) * 4;
+    }
+    if (!started)
+    {
+        close();
+        return false;
+    }
+    start.offset = offset;
+    start.tick = 0;
+    start.tempoTick = 0;
+    start.tempoTimestamp = 0;
+    start.tempo = DefaultTempo;
+
+    // scan the sequence once for the seek index
+    if (indexInterval == 0)
+    {
+        indexInterval = 4 * (uint32)ticksPerQuarterNote;
+    }
+    Position pos = start;
+    Position before;
+    UMPacket packet;
+    uint64 nextIndexTick = 0;
+    while (read(pos, packet, &before))
+    {
+        if (before.tick >= nextIndexTick)
+        {
+            index.push_back(before);
+            nextIndexTick = before.tick - before.tick % indexInterval + indexInterval;
+        }
+    }
+    lengthInTicks = pos.tick;
+    rewind();
+    return true;
+}
+
+
+void MIDI2ClipReader::close()
+{
+    if (data != nullptr)
+    {
+        munmap((void*)data, size);
+        data = nullptr;
+        size = 0;
+    }
+    index.clear();
+    lengthInTicks = 0;
+    ticksPerQuarterNote = DefaultTicksPerQuarterNote;
+}
+
+
+bool MIDI2ClipReader::read(Position& pos, UMPacket& packet, Position* before) const
+{
+    while (pos.offset + 4 <= size)
+    {
+        uint32 word1 = readWord(pos.offset);
+        int packetSize = UMPacket::wordToSize(word1);
+        if (pos.offset + (size_t)packetSize * 4 > size || word1 == EndOfClip)
+        {
+            return false;
+        }
+        if ((word1 >> 20) == (((uint32)UMPacket::Utility << 4) | UMPacket::UtilityStatusDeltaClockstamp))
+        {
+            pos.tick += word1 & CLIP_MAX_DELTA_TICKS;
+            pos.offset += 4;
+            continue;
+        }
+        if (word1 >> 28 == UMPacket::Utility)
+        {
+            // NOOP, DCTPQ, JR messages
+            pos.offset += 4;
+            continue;
+        }
+        if (before != nullptr)
+        {
+            *before = pos;
+        }
+        uint32 words[4];
+        for (int i = 0; i < packetSize; i++)
+        {
+            words[i] = readWord(pos.offset + (size_t)i * 4);
+        }
+        packet = UMPacket(UMPView(words, packetSize));
+        pos.offset += (size_t)packetSize * 4;
+        if (isSetTempo(word1) && words[1] != 0)
+        {
+            pos.tempoTimestamp = toTimestamp(pos);
+            pos.tempoTick = pos.tick;
+            pos.tempo = words[1];
+        }
+        return true;
+    }
+    return false;
+}
+
+
+bool MIDI2ClipReader::next(uint64& timestamp, UMPacket& packet)
+{
+    if (data == nullptr || !read(current, packet, nullptr))
+    {
+        return false;
+    }
+    tick = current.tick;
+    timestamp = toTimestamp(current);
+    return true;
+}
+
+
+void MIDI2ClipReader::rewind()
+{
+    current = start;
+    tick = 0;
+}
+
+
+void MIDI2ClipReader::seekTick(uint64 targetTick)
+{
+    // last index entry at or before the tick
+    auto it = std::upper_bound(index.begin(), index.end(), targetTick,
+                               [](uint64 t, const Position& p) { return t < p.tick; });
+    current = (it == index.begin()) ? start : *(it - 1);
+    // read on to the first packet at or after the tick
+    Position pos = current;
+    Position before;
+    UMPacket packet;
+    while (read(pos, packet, &before) && before.tick < targetTick)
+    {
+        current = pos;
+    }
+    tick = current.tick;
+}
+
+
+void MIDI2ClipReader::seek(uint64 timestamp)
+{
+    auto it = std::upper_bound(index.begin(), index.end(), timestamp,
+                               [this](uint64 t, const Position& p) { return t < toTimestamp(p); });
+    current = (it == index.begin()) ? start : *(it - 1);
+    Position pos = current;
+    Position before;
+    UMPacket packet;
+    while (read(pos, packet, &before) && toTimestamp(before) < timestamp)
+    {
+        current = pos;
+    }
+    tick = current.tick;
+}
+
+
+bool MIDI2ClipReader::process(MIDI2Processor& target, uint64 endTimestamp)
+{
+    Position pos = current;
+    Position before;
+    UMPacket packet;
+    while (read(pos, packet, &before))
+    {
+        uint64 timestamp = toTimestamp(before);
+        if (timestamp >= endTimestamp)
+        {
+            return true;
+        }
+        current = pos;
+        tick = current.tick;
+        target.process(timestamp, packet);
+    }
+    current = pos;
+    return false;
+}
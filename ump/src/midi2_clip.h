@@ -0,0 +1,185 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+
+#include "midi2.h"
+#include <stddef.h>
+#include <vector>
+
+
+/**
+ * MIDI Clip Files (SMF2): a sequence of UMP packets, each preceded by a
+ * Delta Clockstamp (DC) with the ticks since the previous packet.
+ *
+ * Layout: the signature "SMF2CLIP", then the header (DCTPQ with the ticks
+ * per quarter note, and a DC), then the sequence: DC + Start of Clip,
+ * DC + packet pairs, DC + End of Clip. All words are big endian.
+ * Tempo is set by Flex Data Set Tempo messages in the sequence.
+ *
+ * Timestamps used by the reader and writer are in nanoseconds.
+ */
+namespace MIDI2Clip
+{
+    static const char Signature[8] = { 'S', 'M', 'F', '2', 'C', 'L', 'I', 'P' };
+    static const uint32 StartOfClip = 0xF0200000;
+    static const uint32 EndOfClip = 0xF0210000;
+    /** Flex Data, complete, to group, Set Tempo; word 2 is the tempo in 10ns units per quarter note */
+    static const uint32 SetTempo = 0xD0100000;
+    static const uint16 DefaultTicksPerQuarterNote = 960;
+    /** 120 bpm */
+    static const uint32 DefaultTempo = 50000000;
+
+    /** @return true if this is a Set Tempo message */
+    inline bool isSetTempo(uint32 word1) { return (word1 & 0xF0FFFFFF) == SetTempo; }
+}
+
+
+/**
+ * Write all packets to a clip file, with the timestamps converted to
+ * ticks at a fixed tempo. The first packet starts the clip.
+ */
+class MIDI2ClipWriter
+    : public MIDI2Processor
+{
+public:
+    MIDI2ClipWriter();
+    ~MIDI2ClipWriter();
+
+    /**
+     * Create the clip file and write the header and the initial tempo.
+     * @param tempo in 10ns units per quarter note
+     */
+    bool open(const char* path,
+              uint16 ticksPerQuarterNote = MIDI2Clip::DefaultTicksPerQuarterNote,
+              uint32 tempo = MIDI2Clip::DefaultTempo);
+
+    /** write End of Clip and close the file */
+    bool close();
+
+    bool isOpen() const { return fd >= 0; }
+    bool hasError() const { return error; }
+
+    /** write a packet at the given tick; ticks before the previous packet are written at the previous tick */
+    void write(uint64 tick, UMPView packet);
+
+    void process(uint64 timestamp, const UMPacket& packet) override;
+    void process(uint64 timestamp, UMPView packet) override;
+
+private:
+    void writeDeltaClockstamp(uint64 tick);
+    void writeWords(const uint32* words, int count);
+    void flush();
+
+    int fd;
+    bool error;
+    uint16 ticksPerQuarterNote;
+    uint32 tempo;
+    uint64 lastTick;
+    bool hasFirstTimestamp;
+    uint64 firstTimestamp;
+    /** big endian words to be written */
+    std::vector<uint32> buffer;
+    int bufferedWords;
+};
+
+
+/**
+ * Read a clip file by mapping it into memory.
+ *
+ * When opened, the file is scanned once to build a sparse seek index: every
+ * indexInterval ticks, the read position is stored together with the
+ * tempo state needed to continue from there. seek() does a binary search
+ * in the index and reads on from the found entry.
+ */
+class MIDI2ClipReader
+{
+public:
+    MIDI2ClipReader();
+    ~MIDI2ClipReader();
+
+    /**
+     * @param indexInterval ticks between seek index entries, 0 for one per 4 quarter notes
+     * @return false if the file cannot be mapped or is not a clip file
+     */
+    bool open(const char* path, uint32 indexInterval = 0);
+    void close();
+    bool isOpen() const { return data != nullptr; }
+
+    uint16 getTicksPerQuarterNote() const { return ticksPerQuarterNote; }
+    /** @return the tick of End of Clip */
+    uint64 getLengthInTicks() const { return lengthInTicks; }
+    int getIndexSize() const { return (int)index.size(); }
+
+    /**
+     * Get the next packet and its timestamp in nanoseconds.
+     * @return false at the end of the clip
+     */
+    bool next(uint64& timestamp, UMPacket& packet);
+
+    /** @return the tick of the packet last returned by next() */
+    uint64 getTick() const { return tick; }
+
+    void rewind();
+
+    /** continue reading at the first packet at or after the timestamp in nanoseconds */
+    void seek(uint64 timestamp);
+
+    /** continue reading at the first packet at or after the tick */
+    void seekTick(uint64 tick);
+
+    /**
+     * Send all packets with a timestamp before endTimestamp to the target.
+     * @return false when the end of the clip was reached
+     */
+    bool process(MIDI2Processor& target, uint64 endTimestamp);
+
+private:
+    /** the read position, with everything needed to continue reading from there */
+    struct Position
+    {
+        size_t offset;
+        uint64 tick;
+        uint64 tempoTick;
+        uint64 tempoTimestamp;
+        uint32 tempo;
+    };
+
+    uint32 readWord(size_t offset) const;
+    uint64 toTimestamp(const Position& position) const;
+    /**
+     * Read the next packet at pos, skipping Delta Clockstamps.
+     * @param before if not null, receives the position of the packet (after its DC)
+     * @return false at the end of the clip
+     */
+    bool read(Position& pos, UMPacket& packet, Position* before) const;
+
+    const byte* data;
+    size_t size;
+    uint16 ticksPerQuarterNote;
+    uint64 lengthInTicks;
+    Position start;
+    Position current;
+    uint64 tick;
+    std::vector<Position> index;
+};
@@ -0,0 +1,348 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "midi2_codec.h"
+#include <string.h>
+
+// tag bits
+#define CODEC_TIMESTAMP_SAME  (0x01)
+#define CODEC_KEY_SAME        (0x02)
+#define CODEC_LOWER_SAME      (0x04)
+// bit 3: word 2 predicted, bit 4: word 3 predicted, bit 5: word 4 predicted
+#define CODEC_WORD_SAME_SHIFT (3)
+
+// the longest varint accepted by the decoder
+#define CODEC_MAX_VARINT_SIZE (10)
+// the most bytes read by the decoder for one packet, also from corrupt data
+#define CODEC_MAX_DECODED_SIZE (1 + CODEC_MAX_VARINT_SIZE + 2 + 2 + 3 * CODEC_MAX_VARINT_SIZE)
+
+
+static inline byte* writeVarint(byte* out, uint64 value)
+{
+    while (value >= 0x80)
+    {
+        *out++ = (byte)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (byte)value;
+    return out;
+}
+
+
+/** @return nullptr if the varint does not end before end */
+static inline const byte* readVarint(const byte* in, const byte* end, uint64& value)
+{
+    // most deltas fit into one byte
+    if (in < end && *in < 0x80)
+    {
+        value = *in;
+        return in + 1;
+    }
+    uint64 result = 0;
+    int shift = 0;
+    while (in < end && shift < 64)
+    {
+        byte b = *in++;
+        result |= (uint64)(b & 0x7F) << shift;
+        if ((b & 0x80) == 0)
+        {
+            value = result;
+            return in;
+        }
+        shift += 7;
+    }
+    return nullptr;
+}
+
+
+/** like above, for when at least CODEC_MAX_VARINT_SIZE bytes are left */
+static inline const byte* readVarintUnchecked(const byte* in, uint64& value)
+{
+    uint64 b = *in++;
+    if (b < 0x80)
+    {
+        value = b;
+        return in;
+    }
+    uint64 result = b & 0x7F;
+    int shift = 7;
+    do
+    {
+        b = *in++;
+        result |= (b & 0x7F) << shift;
+        shift += 7;
+    }
+    while ((b & 0x80) != 0 && shift < 64);
+    if ((b & 0x80) != 0)
+    {
+        return nullptr;
+    }
+    value = result;
+    return in;
+}
+
+
+template<bool Checked>
+static inline const byte* readVarint(const byte* in, const byte* end, uint64& value)
+{
+    return Checked ? readVarint(in, end, value) : readVarintUnchecked(in, value);
+}
+
+
+static inline uint64 zigzag64(int64 value) { return ((uint64)value << 1) ^ (uint64)(value >> 63); }
+static inline int64 unzigzag64(uint64 value) { return (int64)(value >> 1) ^ -(int64)(value & 1); }
+static inline uint32 zigzag32(int32 value) { return ((uint32)value << 1) ^ (uint32)(value >> 31); }
+static inline int32 unzigzag32(uint32 value) { return (int32)(value >> 1) ^ -(int32)(value & 1); }
+
+
+MIDI2StreamCodec::MIDI2StreamCodec()
+{
+    reset();
+}
+
+
+void MIDI2StreamCodec::reset(uint64 timestamp)
+{
+    lastTimestamp = timestamp;
+    lastKey = 0;
+    memset(predictions, 0, sizeof(predictions));
+}
+
+
+int MIDI2StreamCodec::encode(uint64 timestamp, UMPView packet, byte* out, int maxBytes)
+{
+    if (maxBytes < MaxEncodedPacketSize)
+    {
+        return 0;
+    }
+    const uint32* words = packet.getData();
+    int size = packet.getSizeInWords();
+    uint32 key = words[0] >> 16;
+    uint32* prediction = predictions[getPredictionIndex(key)];
+
+    byte* tag = out;
+    byte* pos = out + 1;
+    byte flags = 0;
+
+    if (timestamp == lastTimestamp)
+    {
+        flags |= CODEC_TIMESTAMP_SAME;
+    }
+    else
+    {
+        pos = writeVarint(pos, zigzag64((int64)(timestamp - lastTimestamp)));
+        lastTimestamp = timestamp;
+    }
+
+    if (key == lastKey)
+    {
+        flags |= CODEC_KEY_SAME;
+    }
+    else
+    {
+        *pos++ = (byte)(key >> 8);
+        *pos++ = (byte)key;
+        lastKey = key;
+    }
+
+    if ((words[0] & 0xFFFF) == (prediction[0] & 0xFFFF))
+    {
+        flags |= CODEC_LOWER_SAME;
+    }
+    else
+    {
+        *pos++ = (byte)(words[0] >> 8);
+        *pos++ = (byte)words[0];
+    }
+    prediction[0] = words[0];
+
+    for (int i = 1; i < size; i++)
+    {
+        if (words[i] == prediction[i])
+        {
+            flags |= (byte)(1 << (CODEC_WORD_SAME_SHIFT + i - 1));
+        }
+        else
+        {
+            pos = writeVarint(pos, zigzag32((int32)(words[i] - prediction[i])));
+            prediction[i] = words[i];
+        }
+    }
+    *tag = flags;
+    return (int)(pos - out);
+}
+
+
+/**
+ * Decode one packet into words, which must have room for 4 words.
+ * Without Checked, at least CODEC_MAX_DECODED_SIZE bytes must be left.
+ * @return the end of the packet in the input, or nullptr if the data is incomplete
+ */
+template<bool Checked>
+inline const byte* MIDI2StreamCodec::decodePacket(const byte* in, const byte* end, uint64& timestamp, uint32* words)
+{
+    const byte* pos = in + 1;
+    byte flags = in[0];
+
+    uint64 value;
+    uint64 ts = lastTimestamp;
+    if ((flags & CODEC_TIMESTAMP_SAME) == 0)
+    {
+        pos = readVarint<Checked>(pos, end, value);
+        if (pos == nullptr)
+        {
+            return nullptr;
+        }
+        ts += (uint64)unzigzag64(value);
+    }
+
+    uint32 key = lastKey;
+    if ((flags & CODEC_KEY_SAME) == 0)
+    {
+        if (Checked && pos + 2 > end)
+        {
+            return nullptr;
+        }
+        key = ((uint32)pos[0] << 8) | pos[1];
+        pos += 2;
+    }
+    uint32* prediction = predictions[getPredictionIndex(key)];
+
+    // words not in the packet keep their prediction, so all 4 can be stored back
+    uint32 lower = prediction[0] & 0xFFFF;
+    if ((flags & CODEC_LOWER_SAME) == 0)
+    {
+        if (Checked && pos + 2 > end)
+        {
+            return nullptr;
+        }
+        lower = ((uint32)pos[0] << 8) | pos[1];
+        pos += 2;
+    }
+    uint32 word1 = (key << 16) | lower;
+    uint32 word2 = prediction[1];
+    uint32 word3 = prediction[2];
+    uint32 word4 = prediction[3];
+
+    // a word which is not sent is predicted, and words beyond the packet size are never sent
+    int size = UMPacket::wordToSize(word1);
+    if (size > 1 && (flags & (1 << CODEC_WORD_SAME_SHIFT)) == 0)
+    {
+        pos = readVarint<Checked>(pos, end, value);
+        if (pos == nullptr)
+        {
+            return nullptr;
+        }
+        word2 += (uint32)unzigzag32((uint32)value);
+    }
+    if (size > 2 && (flags & (2 << CODEC_WORD_SAME_SHIFT)) == 0)
+    {
+        pos = readVarint<Checked>(pos, end, value);
+        if (pos == nullptr)
+        {
+            return nullptr;
+        }
+        word3 += (uint32)unzigzag32((uint32)value);
+    }
+    if (size > 3 && (flags & (4 << CODEC_WORD_SAME_SHIFT)) == 0)
+    {
+        pos = readVarint<Checked>(pos, end, value);
+        if (pos == nullptr)
+        {
+            return nullptr;
+        }
+        word4 += (uint32)unzigzag32((uint32)value);
+    }
+
+    // only commit the state once the whole packet was read
+    lastTimestamp = ts;
+    lastKey = key;
+    prediction[0] = word1;
+    prediction[1] = word2;
+    prediction[2] = word3;
+    prediction[3] = word4;
+    timestamp = ts;
+    words[0] = word1;
+    words[1] = word2;
+    words[2] = word3;
+    words[3] = word4;
+    return pos;
+}
+
+
+int MIDI2StreamCodec::decode(const byte* in, int length, uint64& timestamp, UMPacket& packet)
+{
+    if (length <= 0)
+    {
+        return 0;
+    }
+    uint32 words[4];
+    const byte* pos = decodePacket<true>(in, in + length, timestamp, words);
+    if (pos == nullptr)
+    {
+        return 0;
+    }
+    int size = UMPacket::wordToSize(words[0]);
+    packet = UMPacket(words[0],
+                      size > 1 ? words[1] : 0,
+                      size > 2 ? words[2] : 0,
+                      size > 3 ? words[3] : 0);
+    return (int)(pos - in);
+}
+
+
+int MIDI2StreamCodec::decode(const byte* in, int length, MIDI2Processor& target)
+{
+    // decode straight into the block, the 4 spare words take the unused words of the last packet
+    uint32 words[UMPBlockBuffer::MaxWords + 4];
+    uint64 timestamps[UMPBlockBuffer::MaxWords];
+    int sizeInWords = 0;
+    int packetCount = 0;
+    const byte* pos = in;
+    const byte* end = in + length;
+    while (pos < end)
+    {
+        if (sizeInWords > UMPBlockBuffer::MaxWords - 4)
+        {
+            target.processBlock(UMPBlock(words, sizeInWords, timestamps, packetCount));
+            sizeInWords = 0;
+            packetCount = 0;
+        }
+        // without bounds checks, unless close to the end
+        const byte* next = (end - pos >= CODEC_MAX_DECODED_SIZE)
+            ? decodePacket<false>(pos, end, timestamps[packetCount], words + sizeInWords)
+            : decodePacket<true>(pos, end, timestamps[packetCount], words + sizeInWords);
+        if (next == nullptr)
+        {
+            break;
+        }
+        pos = next;
+        sizeInWords += UMPacket::wordToSize(words[sizeInWords]);
+        packetCount++;
+    }
+    if (packetCount > 0)
+    {
+        target.processBlock(UMPBlock(words, sizeInWords, timestamps, packetCount));
+    }
+    return (int)(pos - in);
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+
+#include "midi2.h"
+
+
+/**
+ * Compact byte encoding of a stream of timestamped UMP packets.
+ *
+ * Every packet starts with a tag byte, followed by only the parts which
+ * differ from the prediction:
+ *  - the timestamp, as zigzag varint delta to the previous timestamp
+ *  - the upper half of word 1 (message type, group, status, channel),
+ *    unless it is the same as in the previous packet
+ *  - the lower half of word 1 and the words 2..4, predicted from the
+ *    previous packet with the same upper half; words 2..4 as zigzag varint
+ *    deltas, so slowly changing controller values take 1 or 2 bytes.
+ *
+ * Encoder and decoder each use their own instance, and must start from the
+ * same state (after construction or reset()).
+ */
+class MIDI2StreamCodec
+{
+public:
+    /** maximum number of bytes produced by encode() for one packet */
+    static const int MaxEncodedPacketSize = 1 + 10 + 2 + 2 + 3 * 5;
+
+    MIDI2StreamCodec();
+
+    /** @param timestamp the timestamp before the first packet, delta-encoded against it */
+    void reset(uint64 timestamp = 0);
+
+    /**
+     * Encode one packet.
+     * @return the number of bytes written, or 0 if maxBytes is too small
+     */
+    int encode(uint64 timestamp, UMPView packet, byte* out, int maxBytes);
+
+    /**
+     * Decode one packet.
+     * @return the number of bytes consumed, or 0 if the data is incomplete
+     */
+    int decode(const byte* in, int length, uint64& timestamp, UMPacket& packet);
+
+    /**
+     * Decode all packets and pass them on to the target as blocks.
+     * @return the number of bytes consumed
+     */
+    int decode(const byte* in, int length, MIDI2Processor& target);
+
+private:
+    static const int PredictionTableSize = 4096;
+
+    static uint32 getPredictionIndex(uint32 key)
+    {
+        return (key * 2654435761u) >> (32 - 12);
+    }
+
+    template<bool Checked>
+    const byte* decodePacket(const byte* in, const byte* end, uint64& timestamp, uint32* words);
+
+    uint64 lastTimestamp;
+    uint32 lastKey;
+    /** the previous packet for each (hashed) upper half of word 1 */
+    uint32 predictions[PredictionTableSize][4];
+};
@@ -0,0 +1,311 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "midi2_data128.h"
+
+#include <stddef.h>
+
+// SysEx8: byte 2 is the stream ID, data starts at byte 3
+#define SYSEX8_STREAM_ID_POSITION    (2)
+#define SYSEX8_DATA_POSITION         (3)
+// Mixed Data Set payload: data starts at byte 2
+#define MDS_PAYLOAD_DATA_POSITION    (2)
+#define MDS_PAYLOAD_BYTES            (14)
+
+
+MIDI2Data128Receiver::MIDI2Data128Receiver(Sink* _sink, int _pieceSize /* = 1024 */, int maxTransfers /* = 8 */)
+    : MIDI2Processor()
+    , sink(_sink)
+    , pieceSize(_pieceSize > 0 ? _pieceSize : 1)
+    , slots(maxTransfers > 0 ? maxTransfers : 1)
+    , droppedTransfers(0)
+    , unexpectedPackets(0)
+{
+    pieces.resize((size_t)pieceSize * slots.size());
+}
+
+
+void MIDI2Data128Receiver::setSink(Sink* _sink)
+{
+    sink = _sink;
+}
+
+
+void MIDI2Data128Receiver::reset()
+{
+    for (int i = 0; i < (int)slots.size(); i++)
+    {
+        if (slots[i].active)
+        {
+            endTransfer(i, false);
+        }
+    }
+}
+
+
+int MIDI2Data128Receiver::getActiveTransferCount() const
+{
+    int count = 0;
+    for (const Slot& slot : slots)
+    {
+        if (slot.active)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+
+const MIDI2Data128Receiver::Transfer* MIDI2Data128Receiver::getTransfer(int slot) const
+{
+    if (slot < 0 || slot >= (int)slots.size() || !slots[slot].active)
+    {
+        return nullptr;
+    }
+    return &slots[slot].transfer;
+}
+
+
+int MIDI2Data128Receiver::findSlot(TransferType type, uint4 group, uint8 id) const
+{
+    for (int i = 0; i < (int)slots.size(); i++)
+    {
+        const Slot& slot = slots[i];
+        if (slot.active && slot.transfer.type == type && slot.transfer.group == group && slot.transfer.id == id)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+int MIDI2Data128Receiver::startTransfer(uint64 timestamp, TransferType type, uint4 group, uint8 id)
+{
+    for (int i = 0; i < (int)slots.size(); i++)
+    {
+        Slot& slot = slots[i];
+        if (!slot.active)
+        {
+            slot.active = true;
+            slot.pieceLength = 0;
+            slot.transfer = Transfer();
+            slot.transfer.type = type;
+            slot.transfer.group = group;
+            slot.transfer.id = id;
+            slot.transfer.startTimestamp = timestamp;
+            if (sink != nullptr)
+            {
+                sink->transferStarted(slot.transfer);
+            }
+            return i;
+        }
+    }
+    droppedTransfers++;
+    return -1;
+}
+
+
+void MIDI2Data128Receiver::append(int slotIndex, const UMPView& packet, int firstPosition, int count)
+{
+    Slot& slot = slots[slotIndex];
+    byte* piece = &pieces[(size_t)slotIndex * pieceSize];
+    for (int i = 0; i < count; i++)
+    {
+        piece[slot.pieceLength++] = packet.getPacketByte(firstPosition + i);
+        if (slot.pieceLength == pieceSize)
+        {
+            slot.transfer.bytesReceived += slot.pieceLength;
+            if (sink != nullptr)
+            {
+                sink->dataReceived(slot.transfer, piece, slot.pieceLength);
+            }
+            slot.pieceLength = 0;
+        }
+    }
+    slot.transfer.packetsReceived++;
+}
+
+
+void MIDI2Data128Receiver::endTransfer(int slotIndex, bool complete)
+{
+    Slot& slot = slots[slotIndex];
+    if (slot.pieceLength > 0)
+    {
+        slot.transfer.bytesReceived += slot.pieceLength;
+        if (sink != nullptr)
+        {
+            sink->dataReceived(slot.transfer, &pieces[(size_t)slotIndex * pieceSize], slot.pieceLength);
+        }
+        slot.pieceLength = 0;
+    }
+    slot.active = false;
+    if (sink != nullptr)
+    {
+        sink->transferEnded(slot.transfer, complete);
+    }
+}
+
+
+void MIDI2Data128Receiver::process(uint64 timestamp, const UMPacket& packet)
+{
+    process(timestamp, UMPView(packet));
+}
+
+
+void MIDI2Data128Receiver::process(uint64 timestamp, UMPView packet)
+{
+    if (packet.getMessageType() != UMPacket::Data128 || packet.getSizeInWords() < 4)
+    {
+        return;
+    }
+    switch (packet.getData128Status())
+    {
+        case UMPacket::Data128StatusSysEx8Complete:
+        case UMPacket::Data128StatusSysEx8Start:
+        case UMPacket::Data128StatusSysEx8Continue:
+        case UMPacket::Data128StatusSysEx8End:
+            processSysEx8(timestamp, packet);
+            break;
+        case UMPacket::Data128StatusMixedDataSetHeader:
+        case UMPacket::Data128StatusMixedDataSetPayload:
+            processMixedDataSet(timestamp, packet);
+            break;
+        default:
+            // reserved
+            break;
+    }
+}
+
+
+void MIDI2Data128Receiver::processSysEx8(uint64 timestamp, const UMPView& packet)
+{
+    uint4 group = packet.getGroup();
+    uint8 streamID = packet.getPacketByte(SYSEX8_STREAM_ID_POSITION);
+    // the byte count includes the stream ID
+    int count = (int)((packet.getWord1() >> 16) & 0x0F) - 1;
+    if (count < 0)
+    {
+        count = 0;
+    }
+    else if (count > 16 - SYSEX8_DATA_POSITION)
+    {
+        count = 16 - SYSEX8_DATA_POSITION;
+    }
+
+    int slot = findSlot(TransferSysEx8, group, streamID);
+    UMPacket::Data128Status status = packet.getData128Status();
+    if (status == UMPacket::Data128StatusSysEx8Complete || status == UMPacket::Data128StatusSysEx8Start)
+    {
+        if (slot >= 0)
+        {
+            // the previous message on this stream was not ended
+            endTransfer(slot, false);
+        }
+        slot = startTransfer(timestamp, TransferSysEx8, group, streamID);
+    }
+    else if (slot < 0)
+    {
+        unexpectedPackets++;
+        return;
+    }
+    if (slot < 0)
+    {
+        return;
+    }
+
+    append(slot, packet, SYSEX8_DATA_POSITION, count);
+    if (status == UMPacket::Data128StatusSysEx8Complete || status == UMPacket::Data128StatusSysEx8End)
+    {
+        endTransfer(slot, true);
+    }
+}
+
+
+void MIDI2Data128Receiver::processMixedDataSet(uint64 timestamp, const UMPView& packet)
+{
+    uint4 group = packet.getGroup();
+    uint8 mdsID = (uint8)((packet.getWord1() >> 16) & 0x0F);
+    int slot = findSlot(TransferMixedDataSet, group, mdsID);
+
+    if (packet.getData128Status() == UMPacket::Data128StatusMixedDataSetHeader)
+    {
+        uint16 chunkNumber = packet.getWordUInt16_2(1);
+        if (slot >= 0 && chunkNumber <= 1)
+        {
+            // a new data set starts, the previous one was not ended
+            endTransfer(slot, false);
+            slot = -1;
+        }
+        if (slot < 0)
+        {
+            slot = startTransfer(timestamp, TransferMixedDataSet, group, mdsID);
+            if (slot < 0)
+            {
+                return;
+            }
+        }
+        Transfer& t = slots[slot].transfer;
+        t.chunkBytes = packet.getWordUInt16_2(0);
+        t.chunkBytesReceived = 0;
+        t.chunkCount = packet.getWordUInt16_1(1);
+        t.chunkNumber = chunkNumber;
+        t.manufacturerID = packet.getWordUInt16_1(2);
+        t.deviceID = packet.getWordUInt16_2(2);
+        t.subID1 = packet.getWordUInt16_1(3);
+        t.subID2 = packet.getWordUInt16_2(3);
+        t.packetsReceived++;
+        if (t.chunkBytes == 0 && t.chunkCount != 0 && t.chunkNumber >= t.chunkCount)
+        {
+            endTransfer(slot, true);
+        }
+        return;
+    }
+
+    // payload
+    if (slot < 0)
+    {
+        unexpectedPackets++;
+        return;
+    }
+    Transfer& t = slots[slot].transfer;
+    int count = t.chunkBytes - t.chunkBytesReceived;
+    if (count > MDS_PAYLOAD_BYTES)
+    {
+        count = MDS_PAYLOAD_BYTES;
+    }
+    if (count <= 0)
+    {
+        // more payload than announced in the header
+        unexpectedPackets++;
+        return;
+    }
+    append(slot, packet, MDS_PAYLOAD_DATA_POSITION, count);
+    t.chunkBytesReceived += (uint16)count;
+    if (t.chunkBytesReceived >= t.chunkBytes && t.chunkCount != 0 && t.chunkNumber >= t.chunkCount)
+    {
+        // last chunk of the data set is complete
+        endTransfer(slot, true);
+    }
+}
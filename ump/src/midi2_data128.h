@@ -0,0 +1,134 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+
+#include "midi2.h"
+#include <vector>
+
+
+/**
+ * Receive System Exclusive 8 and Mixed Data Set messages (Data128 packets)
+ * and stream the payload to a sink in fixed-size pieces.
+ *
+ * Transfers are identified by group and stream ID (SysEx8) or MDS ID
+ * (Mixed Data Set), so interleaved transfers are supported. Only one
+ * piece buffer per concurrent transfer is allocated (in the constructor),
+ * so memory use does not depend on the size of the transfers.
+ *
+ * Not thread safe: call process() from one thread only.
+ */
+class MIDI2Data128Receiver
+    : public MIDI2Processor
+{
+public:
+    typedef enum
+    {
+        TransferSysEx8,
+        TransferMixedDataSet
+    }
+    TransferType;
+
+    /** state and progress counters of one transfer */
+    struct Transfer
+    {
+        TransferType type = TransferSysEx8;
+        uint4 group = 0;
+        /** SysEx8 stream ID, or MDS ID */
+        uint8 id = 0;
+        uint64 startTimestamp = 0;
+        uint64 bytesReceived = 0;
+        uint32 packetsReceived = 0;
+
+        // Mixed Data Set only (from the last chunk header)
+        uint16 chunkNumber = 0;
+        /** total number of chunks, 0 if unknown */
+        uint16 chunkCount = 0;
+        uint16 manufacturerID = 0;
+        uint16 deviceID = 0;
+        uint16 subID1 = 0;
+        uint16 subID2 = 0;
+        /** number of payload bytes in the current chunk */
+        uint16 chunkBytes = 0;
+        uint16 chunkBytesReceived = 0;
+    };
+
+    class Sink
+    {
+    public:
+        virtual ~Sink() {}
+        virtual void transferStarted(const Transfer& /*transfer*/) {}
+        /** the next piece of payload data, only valid during this call */
+        virtual void dataReceived(const Transfer& transfer, const byte* data, int length) = 0;
+        /** @param complete false if the transfer was aborted */
+        virtual void transferEnded(const Transfer& /*transfer*/, bool /*complete*/) {}
+    };
+
+    /**
+     * @param pieceSize the payload is passed to the sink in pieces of this size
+     * @param maxTransfers maximum number of transfers at the same time
+     */
+    MIDI2Data128Receiver(Sink* sink, int pieceSize = 1024, int maxTransfers = 8);
+
+    void setSink(Sink* sink);
+
+    /** all packets other than Data128 are ignored */
+    void process(uint64 timestamp, const UMPacket& packet) override;
+    void process(uint64 timestamp, UMPView packet) override;
+
+    /** abort all running transfers */
+    void reset();
+
+    /** @return the number of running transfers, use getTransfer() to query their progress */
+    int getActiveTransferCount() const;
+    /** @return the transfer in the given slot (0..maxTransfers-1), or nullptr if the slot is not in use */
+    const Transfer* getTransfer(int slot) const;
+
+    /** number of transfers dropped because maxTransfers were running already */
+    uint32 getDroppedTransferCount() const { return droppedTransfers; }
+    /** number of packets which did not belong to a running transfer */
+    uint32 getUnexpectedPacketCount() const { return unexpectedPackets; }
+
+private:
+    struct Slot
+    {
+        Transfer transfer;
+        bool active = false;
+        int pieceLength = 0;
+    };
+
+    int findSlot(TransferType type, uint4 group, uint8 id) const;
+    int startTransfer(uint64 timestamp, TransferType type, uint4 group, uint8 id);
+    void append(int slot, const UMPView& packet, int firstPosition, int count);
+    void endTransfer(int slot, bool complete);
+
+    void processSysEx8(uint64 timestamp, const UMPView& packet);
+    void processMixedDataSet(uint64 timestamp, const UMPView& packet);
+
+    Sink* sink;
+    int pieceSize;
+    std::vector<Slot> slots;
+    std::vector<byte> pieces;
+    uint32 droppedTransfers;
+    uint32 unexpectedPackets;
+};
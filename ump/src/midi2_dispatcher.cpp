@@ -0,0 +1,85 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "midi2_dispatcher.h"
+
+
+MIDI2Dispatcher::MIDI2Dispatcher()
+    : MIDI2Processor()
+{
+    clear();
+}
+
+
+void MIDI2Dispatcher::setHandler(UMPacket::MessageType type, int status, Handler handler, void* context)
+{
+    if (type == UMPacket::System && status >= 0xF0 && status <= 0xFF)
+    {
+        status &= 0x0F;
+    }
+    if ((int)type < 0 || (int)type > 0x0F || status < AnyStatus || status > 0x0F)
+    {
+        return;
+    }
+    if (handler == nullptr)
+    {
+        handler = &ignore;
+        context = nullptr;
+    }
+    int first = (status == AnyStatus) ? 0 : status;
+    int last = (status == AnyStatus) ? 0x0F : status;
+    for (int s = first; s <= last; s++)
+    {
+        Entry& entry = table[(((int)type) << 4) | s];
+        entry.handler = handler;
+        entry.context = context;
+    }
+}
+
+
+void MIDI2Dispatcher::removeHandler(UMPacket::MessageType type, int status /* = AnyStatus */)
+{
+    setHandler(type, status, nullptr, nullptr);
+}
+
+
+void MIDI2Dispatcher::clear()
+{
+    for (Entry& entry : table)
+    {
+        entry.handler = &ignore;
+        entry.context = nullptr;
+    }
+}
+
+
+void MIDI2Dispatcher::processRawUMP(uint64 timestamp, const uint32* rawWords, int sizeInWords)
+{
+    forEachPacket(timestamp, rawWords, sizeInWords, [this](uint64 ts, UMPView packet) { dispatch(ts, packet); });
+}
+
+
+void MIDI2Dispatcher::processBlock(const UMPBlock& block)
+{
+    forEachPacket(block, [this](uint64 ts, UMPView packet) { dispatch(ts, packet); });
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+
+#include "midi2.h"
+
+
+/**
+ * Dispatch packets to handlers registered per message type and status.
+ *
+ * A 256-entry table, indexed by message type (high nibble) and status
+ * (low nibble), is built when handlers are registered. System messages
+ * (message type 1) always have status 0xF, so they are indexed by the low
+ * nibble of their status byte instead, e.g. 8 for Timing Clock (0xF8). Dispatching a
+ * packet is one table load and one indirect call, without switch
+ * statements. Entries without a handler point to an empty function.
+ *
+ * Handlers are either plain functions with a context pointer, or
+ * callables (e.g. lambdas) which are called through a typed trampoline,
+ * so that the callable's body can be inlined:
+ *
+ *     auto onNoteOn = [&](uint64 timestamp, UMPView packet) { ... };
+ *     dispatcher.setHandler(UMPacket::M2ChannelVoice, UMPacket::M2StatusNoteOn, onNoteOn);
+ *
+ * The callable is not copied: it must stay valid as long as it is registered.
+ */
+class MIDI2Dispatcher
+    : public MIDI2Processor
+{
+public:
+    typedef void (*Handler)(void* context, uint64 timestamp, UMPView packet);
+
+    static const int TableSize = 256;
+    /** use as status to register a handler for all statuses of a message type */
+    static const int AnyStatus = -1;
+
+    MIDI2Dispatcher();
+
+    /** @return the table index for a packet with the given first word */
+    static constexpr int getIndex(uint32 word1)
+    {
+        return (int)(((word1 >> 24) & 0xF0) | ((word1 >> ((word1 >> 28) == UMPacket::System ? 16 : 20)) & 0x0F));
+    }
+
+    /**
+     * register a function for the message type and status (0..15, or AnyStatus).
+     * For System messages, the status is the status byte (0xF0..0xFF) or its low nibble.
+     */
+    void setHandler(UMPacket::MessageType type, int status, Handler handler, void* context);
+
+    /**
+     * register a callable for the message type and status (0..15, or AnyStatus).
+     * The callable is referenced, not copied: it must outlive the registration.
+     */
+    template<class Callable>
+    void setHandler(UMPacket::MessageType type, int status, Callable& callable)
+    {
+        setHandler(type, status, &trampoline<Callable>, (void*)&callable);
+    }
+
+    /** remove the handler(s) for the message type and status */
+    void removeHandler(UMPacket::MessageType type, int status = AnyStatus);
+
+    /** remove all handlers */
+    void clear();
+
+    /** call the handler for the packet */
+    void dispatch(uint64 timestamp, UMPView packet) const
+    {
+        const Entry& entry = table[getIndex(packet.getWord1())];
+        entry.handler(entry.context, timestamp, packet);
+    }
+
+    void process(uint64 timestamp, const UMPacket& packet) override { dispatch(timestamp, UMPView(packet)); }
+    void process(uint64 timestamp, UMPView packet) override { dispatch(timestamp, packet); }
+    void processRawUMP(uint64 timestamp, const uint32* rawWords, int sizeInWords) override;
+    void processBlock(const UMPBlock& block) override;
+
+private:
+    struct Entry
+    {
+        Handler handler;
+        void* context;
+    };
+
+    template<class Callable>
+    static void trampoline(void* context, uint64 timestamp, UMPView packet)
+    {
+        (*(Callable*)context)(timestamp, packet);
+    }
+
+    static void ignore(void*, uint64, UMPView) {}
+
+    Entry table[TableSize];
+};
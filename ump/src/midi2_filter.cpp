@@ -0,0 +1,266 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "midi2_filter.h"
+#include "midi2_framing.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define FILTER_AVX2
+#endif
+
+// number of packets for which the keep mask is computed in one go
+#define FILTER_BATCH_PACKETS  (16)
+// number of words scanned in one go
+#define FILTER_CHUNK_WORDS    (256)
+
+
+MIDI2Filter::MIDI2Filter(MIDI2Processor& _downstream)
+    : MIDI2Processor()
+    , downstream(_downstream)
+    , keptCount(0)
+    , droppedCount(0)
+{
+    clearRules();
+}
+
+
+void MIDI2Filter::clearRules()
+{
+    ruleCount = 0;
+    for (uint32& mask : channelMasks)
+    {
+        mask = 0xFFFF;
+    }
+}
+
+
+static bool hasChannel(int messageType)
+{
+    return messageType == UMPacket::M1ChannelVoice || messageType == UMPacket::M2ChannelVoice;
+}
+
+
+void MIDI2Filter::addRule(const Rule& rule)
+{
+    if (ruleCount == 0)
+    {
+        // the first rule: from now on, drop everything not matched by a rule
+        for (uint32& mask : channelMasks)
+        {
+            mask = 0;
+        }
+    }
+    ruleCount++;
+    for (int type = 0; type < 16; type++)
+    {
+        if ((rule.messageTypes & (1 << type)) == 0) continue;
+        uint32 channels = hasChannel(type) ? rule.channels : 0xFFFF;
+        for (int group = 0; group < 16; group++)
+        {
+            if ((rule.groups & (1 << group)) == 0) continue;
+            for (int status = 0; status < 16; status++)
+            {
+                if ((rule.statuses & (1 << status)) == 0) continue;
+                channelMasks[(type << 8) | (group << 4) | status] |= channels;
+            }
+        }
+    }
+}
+
+
+uint32 MIDI2Filter::computeKeepMask(const uint32* words, const uint32* offsets, int count) const
+{
+    if (count > FILTER_BATCH_PACKETS)
+    {
+        count = FILTER_BATCH_PACKETS;
+    }
+    uint32 keep = 0;
+    int i = 0;
+#if defined(FILTER_AVX2)
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i nibble = _mm256_set1_epi32(0x0F);
+    const __m256i highBits = _mm256_set1_epi32(0xFF0);
+    const __m256i system = _mm256_set1_epi32(UMPacket::System);
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i offs = _mm256_loadu_si256((const __m256i*)(offsets + i));
+        __m256i w = _mm256_i32gather_epi32((const int*)words, offs, 4);
+        __m256i channel = _mm256_and_si256(_mm256_srli_epi32(w, 16), nibble);
+        // same as getIndex(): System messages use the low nibble of the status byte
+        __m256i index = _mm256_srli_epi32(w, 20);
+        __m256i isSystem = _mm256_cmpeq_epi32(_mm256_srli_epi32(w, 28), system);
+        __m256i systemIndex = _mm256_or_si256(_mm256_and_si256(index, highBits), channel);
+        index = _mm256_blendv_epi8(index, systemIndex, isSystem);
+        __m256i masks = _mm256_i32gather_epi32((const int*)channelMasks, index, 4);
+        __m256i bits = _mm256_and_si256(_mm256_srlv_epi32(masks, channel), one);
+        // move bit 0 of each lane to bit 31, then collect the sign bits
+        uint32 m = (uint32)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_slli_epi32(bits, 31)));
+        keep |= m << i;
+    }
+#endif
+    for (; i < count; i++)
+    {
+        keep |= (uint32)accepts(words[offsets[i]]) << i;
+    }
+    return keep;
+}
+
+
+void MIDI2Filter::process(uint64 timestamp, const UMPacket& packet)
+{
+    process(timestamp, UMPView(packet));
+}
+
+
+void MIDI2Filter::process(uint64 timestamp, UMPView packet)
+{
+    if (accepts(packet.getWord1()))
+    {
+        keptCount++;
+        downstream.process(timestamp, packet);
+    }
+    else
+    {
+        droppedCount++;
+    }
+}
+
+
+int MIDI2Filter::filterWords(const UMPBlock* source, uint64 timestamp, int firstPacketIndex,
+                             const uint32* rawWords, int sizeInWords, int* packetCount)
+{
+    uint32 offsets[FILTER_CHUNK_WORDS];
+    if (sizeInWords > FILTER_CHUNK_WORDS)
+    {
+        sizeInWords = FILTER_CHUNK_WORDS;
+    }
+    int truncated = 0;
+    int count = UMPFramer::scan(rawWords, sizeInWords, offsets, &truncated);
+    int kept = 0;
+
+    for (int first = 0; first < count; first += FILTER_BATCH_PACKETS)
+    {
+        int batch = count - first;
+        if (batch > FILTER_BATCH_PACKETS)
+        {
+            batch = FILTER_BATCH_PACKETS;
+        }
+        uint32 keep = computeKeepMask(rawWords, offsets + first, batch);
+        while (keep != 0)
+        {
+            int i = getLowestBitIndex(keep);
+            keep &= keep - 1;
+            const uint32* words = rawWords + offsets[first + i];
+            int packetSize = UMPacket::wordToSize(words[0]);
+            uint64 ts = (source != nullptr) ? source->getTimestamp(firstPacketIndex + first + i) : timestamp;
+            if (block.add(ts, words, packetSize) == 0)
+            {
+                downstream.processBlock(block.getBlock());
+                block.clear();
+                block.add(ts, words, packetSize);
+            }
+            kept++;
+        }
+    }
+    keptCount += kept;
+    droppedCount += count - kept;
+    *packetCount = count;
+    return sizeInWords - truncated;
+}
+
+
+void MIDI2Filter::processRawUMP(uint64 timestamp, const uint32* rawWords, int sizeInWords)
+{
+    if (rawWords == nullptr)
+    {
+        return;
+    }
+    block.clear();
+    bool incomplete = false;
+    while (sizeInWords > 0)
+    {
+        int packetCount = 0;
+        int consumed = filterWords(nullptr, timestamp, 0, rawWords, sizeInWords, &packetCount);
+        if (consumed == 0)
+        {
+            incomplete = true;
+            break;
+        }
+        rawWords += consumed;
+        sizeInWords -= consumed;
+    }
+    if (!block.isEmpty())
+    {
+        downstream.processBlock(block.getBlock());
+        block.clear();
+    }
+    // after the kept packets, to keep the order of packets and errors
+    if (incomplete)
+    {
+        onCorruptRawData("incomplete UMP received.");
+    }
+}
+
+
+void MIDI2Filter::processBlock(const UMPBlock& source)
+{
+    const uint32* rawWords = source.getWords();
+    int sizeInWords = source.getSizeInWords();
+    if (rawWords == nullptr)
+    {
+        return;
+    }
+    block.clear();
+    bool incomplete = false;
+    int packetIndex = 0;
+    while (sizeInWords > 0)
+    {
+        int packetCount = 0;
+        int consumed = filterWords(&source, 0, packetIndex, rawWords, sizeInWords, &packetCount);
+        if (consumed == 0)
+        {
+            incomplete = true;
+            break;
+        }
+        packetIndex += packetCount;
+        rawWords += consumed;
+        sizeInWords -= consumed;
+    }
+    if (!block.isEmpty())
+    {
+        downstream.processBlock(block.getBlock());
+        block.clear();
+    }
+    // after the kept packets, to keep the order of packets and errors
+    if (incomplete)
+    {
+        onCorruptRawData("incomplete UMP received.");
+    }
+}
+
+
+void MIDI2Filter::onCorruptRawData(const char* errorMessage)
+{
+    downstream.onCorruptRawData(errorMessage);
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+
+#include "midi2.h"
+
+
+/**
+ * Pass on only packets matching a set of rules to the downstream processor.
+ *
+ * Each rule is a set of masks for group, message type, status and channel;
+ * a packet is kept if any rule matches. The rules are compiled into one
+ * table indexed by message type, group and status (the top 12 bits of the
+ * first word; for System messages, the low nibble of the status byte takes
+ * the place of the status), holding a mask of accepted channels. Evaluating a packet is
+ * a table load and a shift, without branches. For message types without a
+ * channel, the channel mask is ignored.
+ *
+ * processRawUMP() and processBlock() compute keep masks for 16 packets at
+ * a time (using AVX2 gathers where available) and pass the kept packets on
+ * as one block, so dropped packets never reach the downstream processor.
+ */
+class MIDI2Filter
+    : public MIDI2Processor
+{
+public:
+    /**
+     * all masks have one bit per value, e.g. groups = 0x000F for groups 0-3.
+     * For System messages (message type 1), statuses has one bit per low
+     * nibble of the status byte, e.g. bit 8 for Timing Clock (0xF8).
+     */
+    struct Rule
+    {
+        uint16 groups = 0xFFFF;
+        uint16 messageTypes = 0xFFFF;
+        uint16 statuses = 0xFFFF;
+        uint16 channels = 0xFFFF;
+    };
+
+    /** without any rules, all packets are passed on */
+    MIDI2Filter(MIDI2Processor& downstream);
+
+    void addRule(const Rule& rule);
+    void clearRules();
+
+    /**
+     * @return the index into the rule table: message type, group and status,
+     *         or the low nibble of the status byte for System messages
+     */
+    static constexpr uint32 getIndex(uint32 word1)
+    {
+        return ((word1 >> 20) & 0xFF0) | ((word1 >> ((word1 >> 28) == UMPacket::System ? 16 : 20)) & 0x0F);
+    }
+
+    /** @return true if the packet with this first word is kept */
+    bool accepts(uint32 word1) const
+    {
+        return ((channelMasks[getIndex(word1)] >> ((word1 >> 16) & 0x0F)) & 1) != 0;
+    }
+
+    /**
+     * Compute the keep mask for up to 16 packets.
+     * @param words the raw packet words
+     * @param offsets the word offsets of the packets, e.g. from UMPFramer
+     * @param count the number of packets (at most 16)
+     * @return bit n is set if packet n is kept
+     */
+    uint32 computeKeepMask(const uint32* words, const uint32* offsets, int count) const;
+
+    void process(uint64 timestamp, const UMPacket& packet) override;
+    void process(uint64 timestamp, UMPView packet) override;
+    void processRawUMP(uint64 timestamp, const uint32* rawWords, int sizeInWords) override;
+    void processBlock(const UMPBlock& block) override;
+    /** passed on to downstream */
+    void onCorruptRawData(const char* errorMessage) override;
+
+    uint64 getKeptCount() const { return keptCount; }
+    uint64 getDroppedCount() const { return droppedCount; }
+
+private:
+    /** filter the packets and pass them on, @return number of words consumed */
+    int filterWords(const UMPBlock* block, uint64 timestamp, int firstPacketIndex,
+                    const uint32* rawWords, int sizeInWords, int* packetCount);
+
+    MIDI2Processor& downstream;
+    int ruleCount;
+    /** accepted channels, indexed by getIndex() */
+    alignas(32) uint32 channelMasks[4096];
+    UMPBlockBuffer block;
+    uint64 keptCount;
+    uint64 droppedCount;
+};
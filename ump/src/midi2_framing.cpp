@@ -0,0 +1,242 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "midi2_framing.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+// compile both x86 versions, scan() picks one at runtime by the CPU features
+#include <immintrin.h>
+#define FRAMING_AVX2
+#define FRAMING_SSSE3
+#define FRAMING_RUNTIME_DISPATCH
+#define FRAMING_TARGET(isa) __attribute__((target(isa)))
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define FRAMING_AVX2
+#define FRAMING_TARGET(isa)
+#elif defined(__SSSE3__) || defined(__SSE4_1__)
+#include <tmmintrin.h>
+#define FRAMING_SSSE3
+#define FRAMING_TARGET(isa)
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define FRAMING_NEON
+#endif
+
+// number of words for which the sizes are computed in one go
+#define FRAMING_CHUNK_WORDS  (64)
+
+
+// packet size in words, indexed by message type
+static const byte* const packetSizeTable = UMPacket::messageTypeSizes;
+
+
+/** fill sizes[i] with the packet size for a packet starting at words[i] */
+static void computeSizesScalar(const uint32* words, int count, byte* sizes)
+{
+    for (int i = 0; i < count; i++)
+    {
+        sizes[i] = packetSizeTable[words[i] >> 28];
+    }
+}
+
+
+#if defined(FRAMING_AVX2)
+
+FRAMING_TARGET("avx2")
+static void computeSizesAVX2(const uint32* words, int count, byte* sizes)
+{
+    // the table is repeated in both 128-bit lanes, because vpshufb shuffles per lane
+    const __m256i table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)packetSizeTable));
+    const __m256i packMask = _mm256_setr_epi8(
+        0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(words + i));
+        // message type in the low byte of each dword, other bytes are 0
+        __m256i mt = _mm256_srli_epi32(v, 28);
+        __m256i sz = _mm256_shuffle_epi8(table, mt);
+        // gather the low byte of each dword to the bottom of each lane
+        sz = _mm256_shuffle_epi8(sz, packMask);
+        uint32 lo = (uint32)_mm256_extract_epi32(sz, 0);
+        uint32 hi = (uint32)_mm256_extract_epi32(sz, 4);
+        memcpy(sizes + i, &lo, 4);
+        memcpy(sizes + i + 4, &hi, 4);
+    }
+    computeSizesScalar(words + i, count - i, sizes + i);
+}
+
+#endif
+
+
+#if defined(FRAMING_SSSE3)
+
+FRAMING_TARGET("ssse3")
+static void computeSizesSSSE3(const uint32* words, int count, byte* sizes)
+{
+    const __m128i table = _mm_loadu_si128((const __m128i*)packetSizeTable);
+    const __m128i packMask = _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(words + i));
+        __m128i mt = _mm_srli_epi32(v, 28);
+        __m128i sz = _mm_shuffle_epi8(_mm_shuffle_epi8(table, mt), packMask);
+        uint32 packed = (uint32)_mm_cvtsi128_si32(sz);
+        memcpy(sizes + i, &packed, 4);
+    }
+    computeSizesScalar(words + i, count - i, sizes + i);
+}
+
+#endif
+
+
+#if defined(FRAMING_NEON)
+
+static void computeSizesNEON(const uint32* words, int count, byte* sizes)
+{
+    const uint8x16_t table = vld1q_u8(packetSizeTable);
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        uint32x4_t a = vshrq_n_u32(vld1q_u32(words + i), 28);
+        uint32x4_t b = vshrq_n_u32(vld1q_u32(words + i + 4), 28);
+        // narrow the message types to bytes, then look up all 8 at once
+        uint8x8_t mt = vmovn_u16(vcombine_u16(vmovn_u32(a), vmovn_u32(b)));
+        vst1_u8(sizes + i, vqtbl1_u8(table, mt));
+    }
+    computeSizesScalar(words + i, count - i, sizes + i);
+}
+
+#endif
+
+
+typedef void (*ComputeSizesFunction)(const uint32* words, int count, byte* sizes);
+
+struct Implementation
+{
+    ComputeSizesFunction computeSizes;
+    const char* name;
+};
+
+
+static Implementation selectImplementation()
+{
+#if defined(FRAMING_RUNTIME_DISPATCH)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return { computeSizesAVX2, "AVX2" };
+    }
+    if (__builtin_cpu_supports("ssse3"))
+    {
+        return { computeSizesSSSE3, "SSSE3" };
+    }
+    return { computeSizesScalar, "scalar" };
+#elif defined(FRAMING_AVX2)
+    return { computeSizesAVX2, "AVX2" };
+#elif defined(FRAMING_SSSE3)
+    return { computeSizesSSSE3, "SSSE3" };
+#elif defined(FRAMING_NEON)
+    return { computeSizesNEON, "NEON" };
+#else
+    return { computeSizesScalar, "scalar" };
+#endif
+}
+
+
+/** the fastest implementation for this CPU, selected on first use */
+static const Implementation& getImplementation()
+{
+    static const Implementation implementation = selectImplementation();
+    return implementation;
+}
+
+
+static int scanWith(ComputeSizesFunction computeSizesFunction,
+                    const uint32* rawWords, int sizeInWords, uint32* offsets, int* truncatedWords)
+{
+    byte sizes[FRAMING_CHUNK_WORDS];
+    int packetCount = 0;
+    int pos = 0;
+    if (rawWords == nullptr || sizeInWords < 0)
+    {
+        sizeInWords = 0;
+    }
+
+    for (int chunkStart = 0; chunkStart < sizeInWords; chunkStart += FRAMING_CHUNK_WORDS)
+    {
+        int chunkSize = sizeInWords - chunkStart;
+        if (chunkSize > FRAMING_CHUNK_WORDS)
+        {
+            chunkSize = FRAMING_CHUNK_WORDS;
+        }
+        int chunkEnd = chunkStart + chunkSize;
+        if (pos >= chunkEnd)
+        {
+            // the previous packet extends beyond this (short, last) chunk
+            continue;
+        }
+        computeSizesFunction(rawWords + chunkStart, chunkSize, sizes);
+        while (pos < chunkEnd)
+        {
+            offsets[packetCount++] = (uint32)pos;
+            pos += sizes[pos - chunkStart];
+        }
+    }
+
+    int truncated = 0;
+    if (pos > sizeInWords)
+    {
+        // the last packet extends beyond the end of the stream
+        packetCount--;
+        truncated = sizeInWords - (int)offsets[packetCount];
+    }
+    if (truncatedWords != nullptr)
+    {
+        *truncatedWords = truncated;
+    }
+    return packetCount;
+}
+
+
+int UMPFramer::scan(const uint32* rawWords, int sizeInWords, uint32* offsets, int* truncatedWords /* = nullptr */)
+{
+    return scanWith(getImplementation().computeSizes, rawWords, sizeInWords, offsets, truncatedWords);
+}
+
+
+int UMPFramer::scanScalar(const uint32* rawWords, int sizeInWords, uint32* offsets, int* truncatedWords /* = nullptr */)
+{
+    return scanWith(computeSizesScalar, rawWords, sizeInWords, offsets, truncatedWords);
+}
+
+
+const char* UMPFramer::getImplementationName()
+{
+    return getImplementation().name;
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+
+#include "midi2.h"
+
+
+/**
+ * Find the packet boundaries in a raw UMP word stream.
+ *
+ * The packet size of every word is looked up in parallel (SSSE3/AVX2 or NEON
+ * byte shuffles on the message type nibble, scalar otherwise), then the
+ * packet starts are collected in one pass over the precomputed sizes.
+ * On x86 with GCC or Clang, the AVX2 and SSSE3 versions are always compiled
+ * in, and the first call picks the best one the CPU supports, so no -mavx2
+ * or -mssse3 flags are needed. Other compilers use the instruction set
+ * enabled at compile time.
+ * The resulting offset index can be used by batch stages without
+ * parsing the stream again.
+ */
+class UMPFramer
+{
+public:
+    /**
+     * Find the start of every complete packet in rawWords.
+     *
+     * @param offsets receives the word offset of each packet start,
+     *        must have room for sizeInWords entries
+     * @param truncatedWords if not null, receives the number of words of an
+     *        incomplete packet at the end of rawWords, or 0
+     * @return the number of complete packets
+     */
+    static int scan(const uint32* rawWords, int sizeInWords, uint32* offsets, int* truncatedWords = nullptr);
+
+    /** same as scan(), but never uses SIMD instructions */
+    static int scanScalar(const uint32* rawWords, int sizeInWords, uint32* offsets, int* truncatedWords = nullptr);
+
+    /** @return the name of the instruction set used by scan() on this CPU */
+    static const char* getImplementationName();
+};
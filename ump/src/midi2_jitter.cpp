@@ -0,0 +1,218 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "midi2_jitter.h"
+
+#include <string.h>
+
+// smoothing factors for the clock estimation
+#define JR_OFFSET_SMOOTHING  (1.0 / 16.0)
+#define JR_RATE_SMOOTHING    (1.0 / 64.0)
+// only estimate the rate once the samples span at least this many JR ticks (1 second)
+#define JR_RATE_MIN_SPAN     (31250)
+
+
+//
+// MARK: MIDI2JRSender
+//
+
+MIDI2JRSender::MIDI2JRSender(MIDI2Processor& _downstream, uint64 _timestampTicksPerSecond)
+    : MIDI2Processor()
+    , downstream(_downstream)
+    , timestampTicksPerSecond(_timestampTicksPerSecond > 0 ? _timestampTicksPerSecond : 1)
+    , clockInterval(timestampTicksPerSecond / 4)
+{
+    memset(lastClockTimestamp, 0, sizeof(lastClockTimestamp));
+    memset(lastJRTimestamp, 0, sizeof(lastJRTimestamp));
+    memset(hasClock, 0, sizeof(hasClock));
+    memset(hasJRTimestamp, 0, sizeof(hasJRTimestamp));
+}
+
+
+uint16 MIDI2JRSender::toJRTime(uint64 timestamp) const
+{
+    // split to avoid overflow of timestamp * JRTicksPerSecond
+    uint64 seconds = timestamp / timestampTicksPerSecond;
+    uint64 fraction = timestamp % timestampTicksPerSecond;
+    return (uint16)((seconds * UMPacket::JRTicksPerSecond)
+                    + (fraction * UMPacket::JRTicksPerSecond) / timestampTicksPerSecond);
+}
+
+
+void MIDI2JRSender::process(uint64 timestamp, const UMPacket& packet)
+{
+    process(timestamp, UMPView(packet));
+}
+
+
+void MIDI2JRSender::process(uint64 timestamp, UMPView packet)
+{
+    if (packet.getMessageType() == UMPacket::Utility)
+    {
+        // do not forward any incoming JR messages, we create our own;
+        // NOOP and Delta Clockstamps (e.g. from clip playback) pass
+        UMPacket::UtilityStatus status = packet.getUtilityStatus();
+        if (status == UMPacket::UtilityStatusJRClock || status == UMPacket::UtilityStatusJRTimestamp)
+        {
+            return;
+        }
+        downstream.process(timestamp, packet);
+        return;
+    }
+
+    uint4 group = packet.getGroup();
+    if (!hasClock[group] || timestamp - lastClockTimestamp[group] >= clockInterval)
+    {
+        downstream.process(timestamp, UMPacket().initJRClock(group, toJRTime(timestamp)));
+        hasClock[group] = true;
+        lastClockTimestamp[group] = timestamp;
+    }
+    if (!hasJRTimestamp[group] || timestamp != lastJRTimestamp[group])
+    {
+        downstream.process(timestamp, UMPacket().initJRTimestamp(group, toJRTime(timestamp)));
+        hasJRTimestamp[group] = true;
+        lastJRTimestamp[group] = timestamp;
+    }
+    downstream.process(timestamp, packet);
+}
+
+
+//
+// MARK: MIDI2JRReceiver
+//
+
+MIDI2JRReceiver::MIDI2JRReceiver(MIDI2Processor& _downstream, uint64 timestampTicksPerSecond)
+    : MIDI2Processor()
+    , downstream(_downstream)
+    , nominalRate((double)timestampTicksPerSecond / (double)UMPacket::JRTicksPerSecond)
+{
+    reset();
+}
+
+
+void MIDI2JRReceiver::reset()
+{
+    clockSampleCount = 0;
+    senderClock = 0;
+    senderAnchor = 0;
+    localAnchor = 0;
+    rate = nominalRate;
+    offset = 0.0;
+    memset(jrTimestampLocal, 0, sizeof(jrTimestampLocal));
+    memset(jrTimestampReceived, 0, sizeof(jrTimestampReceived));
+    memset(hasJRTimestamp, 0, sizeof(hasJRTimestamp));
+}
+
+
+double MIDI2JRReceiver::getDriftPPM() const
+{
+    return ((rate / nominalRate) - 1.0) * 1000000.0;
+}
+
+
+int64 MIDI2JRReceiver::unwrap(uint16 jrTime) const
+{
+    return senderClock + (int16)(uint16)(jrTime - (uint16)senderClock);
+}
+
+
+uint64 MIDI2JRReceiver::senderToLocal(int64 senderTicks) const
+{
+    double local = (double)localAnchor + offset + rate * (double)(senderTicks - senderAnchor);
+    return (local > 0.0) ? (uint64)local : 0;
+}
+
+
+void MIDI2JRReceiver::clockReceived(uint64 localTimestamp, uint16 jrTime)
+{
+    if (clockSampleCount == 0)
+    {
+        senderClock = jrTime;
+        senderAnchor = senderClock;
+        localAnchor = localTimestamp;
+        rate = nominalRate;
+        offset = 0.0;
+        clockSampleCount = 1;
+        return;
+    }
+
+    // the 16-bit clock wraps every ~2 seconds: assume that at least one
+    // JR Clock message is received per wrap
+    senderClock += (uint16)(jrTime - (uint16)senderClock);
+    clockSampleCount++;
+
+    double senderSpan = (double)(senderClock - senderAnchor);
+    double localSpan = (double)(int64)(localTimestamp - localAnchor);
+    if (senderSpan >= JR_RATE_MIN_SPAN)
+    {
+        // drift: the long term ratio of local to sender time
+        rate += ((localSpan / senderSpan) - rate) * JR_RATE_SMOOTHING;
+    }
+    // jitter: smooth the offset of the individual samples
+    double error = localSpan - (offset + rate * senderSpan);
+    offset += error * JR_OFFSET_SMOOTHING;
+}
+
+
+void MIDI2JRReceiver::process(uint64 timestamp, const UMPacket& packet)
+{
+    process(timestamp, UMPView(packet));
+}
+
+
+void MIDI2JRReceiver::process(uint64 timestamp, UMPView packet)
+{
+    uint4 group = packet.getGroup();
+    if (packet.getMessageType() == UMPacket::Utility)
+    {
+        switch (packet.getUtilityStatus())
+        {
+            case UMPacket::UtilityStatusJRClock:
+                clockReceived(timestamp, packet.getJRTime());
+                return;
+            case UMPacket::UtilityStatusJRTimestamp:
+                if (isSynchronized())
+                {
+                    jrTimestampLocal[group] = senderToLocal(unwrap(packet.getJRTime()));
+                    jrTimestampReceived[group] = timestamp;
+                    hasJRTimestamp[group] = true;
+                }
+                return;
+            case UMPacket::UtilityStatusNOOP:
+                return;
+            case UMPacket::UtilityStatusDeltaClockstampTPQ:
+            case UMPacket::UtilityStatusDeltaClockstamp:
+                // not related to JR: pass on below
+                break;
+        }
+    }
+
+    if (hasJRTimestamp[group] && jrTimestampReceived[group] == timestamp)
+    {
+        downstream.process(jrTimestampLocal[group], packet);
+    }
+    else
+    {
+        downstream.process(timestamp, packet);
+    }
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+
+#include "midi2.h"
+
+
+/**
+ * Sender side of Jitter Reduction (JR): passes all packets on to the
+ * downstream processor, and inserts JR Timestamp and JR Clock messages.
+ *
+ * The packet timestamps are used as sender time. A JR Timestamp is
+ * inserted in front of every run of packets of one group with the same
+ * timestamp, and a JR Clock message at least every clock interval.
+ */
+class MIDI2JRSender
+    : public MIDI2Processor
+{
+public:
+    /**
+     * @param downstream receives the packets including the JR messages
+     * @param timestampTicksPerSecond the unit of the packet timestamps,
+     *        e.g. 1000000000 for nanoseconds
+     */
+    MIDI2JRSender(MIDI2Processor& downstream, uint64 timestampTicksPerSecond);
+
+    /** how often to send a JR Clock message per group, in timestamp units (default: 250ms) */
+    void setClockInterval(uint64 interval) { clockInterval = interval; }
+
+    void process(uint64 timestamp, const UMPacket& packet) override;
+    void process(uint64 timestamp, UMPView packet) override;
+
+    /** @return the given timestamp in JR ticks, truncated to 16 bits */
+    uint16 toJRTime(uint64 timestamp) const;
+
+private:
+    MIDI2Processor& downstream;
+    uint64 timestampTicksPerSecond;
+    uint64 clockInterval;
+    uint64 lastClockTimestamp[16];
+    uint64 lastJRTimestamp[16];
+    bool hasClock[16];
+    bool hasJRTimestamp[16];
+};
+
+
+/**
+ * Receiver side of Jitter Reduction (JR): consumes JR Clock and
+ * JR Timestamp messages and passes all other packets on to the downstream
+ * processor.
+ *
+ * The JR Clock messages are used to estimate the offset and drift of the
+ * sender clock relative to the local clock (the timestamps passed to
+ * process()). Packets following a JR Timestamp of their group in the same
+ * receive call are passed on with the JR Timestamp mapped to the local
+ * clock, all others with their original timestamp.
+ */
+class MIDI2JRReceiver
+    : public MIDI2Processor
+{
+public:
+    /**
+     * @param downstream receives all non-JR packets
+     * @param timestampTicksPerSecond the unit of the local timestamps
+     */
+    MIDI2JRReceiver(MIDI2Processor& downstream, uint64 timestampTicksPerSecond);
+
+    void process(uint64 timestamp, const UMPacket& packet) override;
+    void process(uint64 timestamp, UMPView packet) override;
+
+    /** forget all clock samples */
+    void reset();
+
+    /** @return true if enough JR Clock messages were received to map timestamps */
+    bool isSynchronized() const { return clockSampleCount >= 2; }
+
+    /** @return the estimated drift of the sender clock in parts per million */
+    double getDriftPPM() const;
+
+    /** @return the local time for the given (unwrapped) sender time in JR ticks */
+    uint64 senderToLocal(int64 senderTicks) const;
+
+    int getClockSampleCount() const { return clockSampleCount; }
+
+private:
+    void clockReceived(uint64 localTimestamp, uint16 jrTime);
+    /** @return the sender time of a 16-bit JR time, unwrapped close to the current sender clock */
+    int64 unwrap(uint16 jrTime) const;
+
+    MIDI2Processor& downstream;
+    double nominalRate; // local ticks per JR tick
+
+    // clock estimation: local = localAnchor + offset + rate * (sender - senderAnchor)
+    int clockSampleCount;
+    int64 senderClock; // unwrapped sender clock, in JR ticks
+    int64 senderAnchor;
+    uint64 localAnchor;
+    double rate;
+    double offset;
+
+    // pending JR Timestamp per group
+    uint64 jrTimestampLocal[16];
+    uint64 jrTimestampReceived[16];
+    bool hasJRTimestamp[16];
+};
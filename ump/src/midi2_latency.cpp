@@ -0,0 +1,196 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "midi2_latency.h"
+#include <stdio.h>
+
+
+//
+// MARK: MIDI2LatencyHistogram
+//
+
+MIDI2LatencyHistogram::MIDI2LatencyHistogram()
+{
+    reset();
+}
+
+
+void MIDI2LatencyHistogram::reset()
+{
+    for (std::atomic<uint64>& count : counts)
+    {
+        count.store(0, std::memory_order_relaxed);
+    }
+    totalCount.store(0, std::memory_order_relaxed);
+    totalNanos.store(0, std::memory_order_relaxed);
+    maxNanos.store(0, std::memory_order_relaxed);
+}
+
+
+double MIDI2LatencyHistogram::getMean() const
+{
+    uint64 count = getCount();
+    return count > 0 ? (double)totalNanos.load(std::memory_order_relaxed) / count : 0.0;
+}
+
+
+uint64 MIDI2LatencyHistogram::getLowestValue(int index)
+{
+    if (index < SubBucketCount)
+    {
+        return (uint64)index;
+    }
+    int shift = index / SubBucketCount - 1;
+    uint64 subBucket = (uint64)(index % SubBucketCount) + SubBucketCount;
+    return subBucket << shift;
+}
+
+
+uint64 MIDI2LatencyHistogram::getHighestValue(int index)
+{
+    if (index < SubBucketCount)
+    {
+        return (uint64)index;
+    }
+    int shift = index / SubBucketCount - 1;
+    return getLowestValue(index) + ((uint64)1 << shift) - 1;
+}
+
+
+uint64 MIDI2LatencyHistogram::getValueAtPercentile(double percentile) const
+{
+    // the counts may change while summing up, so use the sum of the buckets
+    uint64 total = 0;
+    for (const std::atomic<uint64>& count : counts)
+    {
+        total += count.load(std::memory_order_relaxed);
+    }
+    if (total == 0)
+    {
+        return 0;
+    }
+    if (percentile > 100.0)
+    {
+        percentile = 100.0;
+    }
+    uint64 target = (uint64)(percentile / 100.0 * (double)total + 0.5);
+    if (target == 0)
+    {
+        target = 1;
+    }
+    uint64 sum = 0;
+    for (int i = 0; i < BucketCount; i++)
+    {
+        sum += counts[i].load(std::memory_order_relaxed);
+        if (sum >= target)
+        {
+            // do not report more than was actually recorded
+            uint64 max = getMax();
+            uint64 value = getHighestValue(i);
+            return (max > 0 && value > max) ? max : value;
+        }
+    }
+    return getMax();
+}
+
+
+int MIDI2LatencyHistogram::exportPercentiles(char* buffer, int size) const
+{
+    if (buffer == nullptr || size <= 0)
+    {
+        return 0;
+    }
+    int n = snprintf(buffer, (size_t)size,
+                     "count=%llu mean=%.1fus p50=%.1fus p90=%.1fus p99=%.1fus p99.9=%.1fus p99.99=%.1fus max=%.1fus",
+                     getCount(), getMean() / 1000.0,
+                     getValueAtPercentile(50.0) / 1000.0,
+                     getValueAtPercentile(90.0) / 1000.0,
+                     getValueAtPercentile(99.0) / 1000.0,
+                     getValueAtPercentile(99.9) / 1000.0,
+                     getValueAtPercentile(99.99) / 1000.0,
+                     getMax() / 1000.0);
+    return (n < size) ? n : size - 1;
+}
+
+
+//
+// MARK: MIDI2LatencyProbe
+//
+
+MIDI2LatencyProbe::MIDI2LatencyProbe(MIDI2LatencyHistogram& _histogram, MIDI2Processor* _downstream)
+    : MIDI2Processor()
+    , histogram(_histogram)
+    , downstream(_downstream)
+{
+}
+
+
+void MIDI2LatencyProbe::process(uint64 timestamp, const UMPacket& packet)
+{
+    record(timestamp);
+    if (downstream != nullptr)
+    {
+        downstream->process(timestamp, packet);
+    }
+}
+
+
+void MIDI2LatencyProbe::process(uint64 timestamp, UMPView packet)
+{
+    record(timestamp);
+    if (downstream != nullptr)
+    {
+        downstream->process(timestamp, packet);
+    }
+}
+
+
+void MIDI2LatencyProbe::processRawUMP(uint64 timestamp, const uint32* rawWords, int sizeInWords)
+{
+    // one record per packet, like process() and processBlock()
+    passRawUMP(downstream, timestamp, rawWords, sizeInWords, [this](uint64 ts, UMPView packet)
+    {
+        (void)packet;
+        record(ts);
+    });
+}
+
+
+void MIDI2LatencyProbe::processBlock(const UMPBlock& block)
+{
+    // also works for blocks with a shared timestamp, where the packet count is unknown
+    passBlock(downstream, block, [this](uint64 ts, UMPView packet)
+    {
+        (void)packet;
+        record(ts);
+    });
+}
+
+
+void MIDI2LatencyProbe::onCorruptRawData(const char* errorMessage)
+{
+    if (downstream != nullptr)
+    {
+        downstream->onCorruptRawData(errorMessage);
+    }
+}
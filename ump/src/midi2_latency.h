@@ -0,0 +1,137 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+
+#include "midi2.h"
+#include <atomic>
+
+
+/**
+ * A latency histogram with log-linear buckets, like HdrHistogram:
+ * values are grouped by powers of 2, and every power of 2 is divided into
+ * 32 linear sub-buckets, so all values are recorded with about 3% precision.
+ *
+ * record() is lock-free and can be called from several threads at once.
+ */
+class MIDI2LatencyHistogram
+{
+public:
+    static const int SubBucketBits = 5;
+    static const int SubBucketCount = 1 << SubBucketBits;
+    static const int BucketCount = (64 - SubBucketBits + 1) * SubBucketCount;
+
+    MIDI2LatencyHistogram();
+
+    /** @param nanos the latency in nanoseconds */
+    void record(uint64 nanos)
+    {
+        counts[getIndex(nanos)].fetch_add(1, std::memory_order_relaxed);
+        totalCount.fetch_add(1, std::memory_order_relaxed);
+        totalNanos.fetch_add(nanos, std::memory_order_relaxed);
+        uint64 max = maxNanos.load(std::memory_order_relaxed);
+        while (nanos > max && !maxNanos.compare_exchange_weak(max, nanos, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    /** set all counts to 0; values recorded at the same time may get lost */
+    void reset();
+
+    uint64 getCount() const { return totalCount.load(std::memory_order_relaxed); }
+    uint64 getMax() const { return maxNanos.load(std::memory_order_relaxed); }
+    double getMean() const;
+
+    /**
+     * @param percentile 0..100
+     * @return the highest value of the bucket reaching the percentile, in nanoseconds
+     */
+    uint64 getValueAtPercentile(double percentile) const;
+
+    /**
+     * Write the percentiles 50, 90, 99, 99.9, 99.99 and the maximum in
+     * microseconds as text, e.g. for logging.
+     * @return the number of characters written
+     */
+    int exportPercentiles(char* buffer, int size) const;
+
+    static int getIndex(uint64 value)
+    {
+        if (value < (uint64)SubBucketCount)
+        {
+            return (int)value;
+        }
+        int exponent = getHighestBitIndex64(value);
+        int shift = exponent - SubBucketBits;
+        return (shift + 1) * SubBucketCount + (int)((value >> shift) - SubBucketCount);
+    }
+
+    /** @return the lowest value recorded in the bucket */
+    static uint64 getLowestValue(int index);
+    /** @return the highest value recorded in the bucket */
+    static uint64 getHighestValue(int index);
+
+private:
+    std::atomic<uint64> counts[BucketCount];
+    std::atomic<uint64> totalCount;
+    std::atomic<uint64> totalNanos;
+    std::atomic<uint64> maxNanos;
+};
+
+
+/**
+ * Record the latency of every packet passing through, as the time from
+ * the packet timestamp to now, and pass the packets on unchanged.
+ *
+ * Put probes at several points of a processor chain (e.g. after the input,
+ * after a queue, before the output), each with its own histogram. Where
+ * there is no processor, e.g. in a MIDI2Translator::Listener, call record().
+ * The packet timestamps must be host time, as delivered by MIDI2AppleInput
+ * and MIDI2Clock::getHostTime(); packets with timestamp 0 are not recorded.
+ */
+class MIDI2LatencyProbe
+    : public MIDI2Processor
+{
+public:
+    MIDI2LatencyProbe(MIDI2LatencyHistogram& histogram, MIDI2Processor* downstream = nullptr);
+
+    /** record the time from the timestamp to now */
+    void record(uint64 timestamp)
+    {
+        if (timestamp != 0)
+        {
+            uint64 now = MIDI2Clock::getHostTime();
+            histogram.record(now > timestamp ? MIDI2Clock::hostTimeToNanos(now - timestamp) : 0);
+        }
+    }
+
+    void process(uint64 timestamp, const UMPacket& packet) override;
+    void process(uint64 timestamp, UMPView packet) override;
+    void processRawUMP(uint64 timestamp, const uint32* rawWords, int sizeInWords) override;
+    void processBlock(const UMPBlock& block) override;
+    void onCorruptRawData(const char* errorMessage) override;
+
+private:
+    MIDI2LatencyHistogram& histogram;
+    MIDI2Processor* downstream;
+};
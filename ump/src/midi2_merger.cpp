@@ -0,0 +1,157 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "midi2_merger.h"
+
+#include <algorithm>
+
+
+MIDI2StreamMerger::MIDI2StreamMerger(int sourceCount, MIDI2Processor& _downstream, int queueCapacityInWords /* = 16384 */)
+    : downstream(_downstream)
+    , sources(sourceCount > 0 ? sourceCount : 0)
+    , latenessWindow(0)
+    , lastEmittedTimestamp(0)
+    , dropLatePackets(false)
+    , hasEmitted(false)
+{
+    for (Source& source : sources)
+    {
+        source.queue.reset(new MIDI2PacketQueue(queueCapacityInWords));
+        source.writer.reset(new MIDI2QueueWriter(*source.queue));
+    }
+    heap.reserve(sources.size());
+}
+
+
+bool MIDI2StreamMerger::isBefore(int a, int b) const
+{
+    const Source& sa = sources[a];
+    const Source& sb = sources[b];
+    if (sa.headTimestamp != sb.headTimestamp)
+    {
+        return sa.headTimestamp < sb.headTimestamp;
+    }
+    return a < b;
+}
+
+
+void MIDI2StreamMerger::fetch(int sourceIndex)
+{
+    Source& source = sources[sourceIndex];
+    while (!source.hasHead && source.queue->read(source.headTimestamp, source.head))
+    {
+        source.stats.sequence++;
+        if (hasEmitted && source.headTimestamp < lastEmittedTimestamp)
+        {
+            source.stats.late++;
+            if (dropLatePackets)
+            {
+                source.stats.dropped++;
+                continue;
+            }
+        }
+        source.hasHead = true;
+        heap.push_back(sourceIndex);
+        // std::push_heap builds a max-heap, so invert the order
+        std::push_heap(heap.begin(), heap.end(), [this](int a, int b) { return isBefore(b, a); });
+    }
+}
+
+
+int MIDI2StreamMerger::emitUntil(uint64 maxTimestamp, bool all)
+{
+    for (int i = 0; i < (int)sources.size(); i++)
+    {
+        fetch(i);
+    }
+
+    auto later = [this](int a, int b) { return isBefore(b, a); };
+    int count = 0;
+    block.clear();
+    while (!heap.empty())
+    {
+        int sourceIndex = heap.front();
+        Source& source = sources[sourceIndex];
+        if (!all && source.headTimestamp > maxTimestamp)
+        {
+            break;
+        }
+        std::pop_heap(heap.begin(), heap.end(), later);
+        heap.pop_back();
+
+        const uint32* words = source.head.getData();
+        int sizeInWords = source.head.getSizeInWords();
+        if (block.add(source.headTimestamp, words, sizeInWords) == 0)
+        {
+            downstream.processBlock(block.getBlock());
+            block.clear();
+            block.add(source.headTimestamp, words, sizeInWords);
+        }
+        if (!hasEmitted || source.headTimestamp > lastEmittedTimestamp)
+        {
+            lastEmittedTimestamp = source.headTimestamp;
+        }
+        hasEmitted = true;
+        source.stats.emitted++;
+        source.hasHead = false;
+        count++;
+
+        fetch(sourceIndex);
+    }
+    if (!block.isEmpty())
+    {
+        downstream.processBlock(block.getBlock());
+        block.clear();
+    }
+    return count;
+}
+
+
+int MIDI2StreamMerger::poll(uint64 now)
+{
+    if (now < latenessWindow)
+    {
+        // nothing is old enough yet, but collect the pending packets
+        for (int i = 0; i < (int)sources.size(); i++)
+        {
+            fetch(i);
+        }
+        return 0;
+    }
+    return emitUntil(now - latenessWindow, false);
+}
+
+
+int MIDI2StreamMerger::flush()
+{
+    return emitUntil(0, true);
+}
+
+
+MIDI2StreamMerger::SourceStats MIDI2StreamMerger::getSourceStats(int sourceIndex) const
+{
+    const Source& source = sources[sourceIndex];
+    SourceStats stats = source.stats;
+    stats.dropped += source.queue->getDroppedPacketCount();
+    return stats;
+}
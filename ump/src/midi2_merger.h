@@ -0,0 +1,127 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+
+#include "midi2_queue.h"
+#include <memory>
+#include <vector>
+
+
+/**
+ * Merge the packets of several inputs into one downstream processor,
+ * in global timestamp order.
+ *
+ * Every source writes to its own MIDI2PacketQueue, e.g. by using
+ * getSourceInput() as receiver of a MIDI input. The merger thread calls
+ * poll() regularly: it keeps the oldest packet of every source in a
+ * min-heap and emits packets once they are older than the lateness window.
+ * Packets which arrive after younger packets were already emitted are
+ * late: they are counted, and either emitted right away or dropped.
+ * Packets with equal timestamps are emitted in source order.
+ * The packets of each single source must be in timestamp order.
+ */
+class MIDI2StreamMerger
+{
+public:
+    /** per-source counters */
+    struct SourceStats
+    {
+        /** sequence number of the next packet from this source */
+        uint64 sequence = 0;
+        uint64 emitted = 0;
+        /** packets which arrived after younger packets were emitted */
+        uint64 late = 0;
+        /** late packets dropped, plus packets dropped because the queue was full */
+        uint64 dropped = 0;
+    };
+
+    /**
+     * @param sourceCount the number of inputs
+     * @param downstream receives the merged packets via processBlock()
+     * @param queueCapacityInWords queue size for each input
+     */
+    MIDI2StreamMerger(int sourceCount, MIDI2Processor& downstream, int queueCapacityInWords = 16384);
+
+    int getSourceCount() const { return (int)sources.size(); }
+
+    /** the queue of the given source, to be written by exactly one thread */
+    MIDI2PacketQueue& getSourceQueue(int sourceIndex) { return *sources[sourceIndex].queue; }
+
+    /** a processor writing to the queue of the given source */
+    MIDI2Processor& getSourceInput(int sourceIndex) { return *sources[sourceIndex].writer; }
+
+    /**
+     * Hold back packets for this long, so that packets of slower sources
+     * can still be sorted in. Same unit as the packet timestamps.
+     */
+    void setLatenessWindow(uint64 window) { latenessWindow = window; }
+    uint64 getLatenessWindow() const { return latenessWindow; }
+
+    /** if set, late packets are dropped instead of being emitted out of order */
+    void setDropLatePackets(bool drop) { dropLatePackets = drop; }
+
+    /**
+     * Collect new packets from all sources and emit all packets with
+     * timestamp + latenessWindow <= now.
+     * Must always be called from the same thread.
+     * @return the number of packets emitted
+     */
+    int poll(uint64 now);
+
+    /** emit all pending packets, regardless of the lateness window */
+    int flush();
+
+    /**
+     * @return the counters for the given source.
+     * Must be called from the thread calling poll() and flush().
+     */
+    SourceStats getSourceStats(int sourceIndex) const;
+
+private:
+    struct Source
+    {
+        std::unique_ptr<MIDI2PacketQueue> queue;
+        std::unique_ptr<MIDI2QueueWriter> writer;
+        SourceStats stats;
+        /** the oldest packet of this source, if hasHead */
+        UMPacket head;
+        uint64 headTimestamp = 0;
+        bool hasHead = false;
+    };
+
+    /** read the next packet of the source into its head and put it on the heap */
+    void fetch(int sourceIndex);
+    int emitUntil(uint64 maxTimestamp, bool all);
+    bool isBefore(int a, int b) const;
+
+    MIDI2Processor& downstream;
+    std::vector<Source> sources;
+    /** source indexes with hasHead, heap ordered by head timestamp */
+    std::vector<int> heap;
+    UMPBlockBuffer block;
+    uint64 latenessWindow;
+    uint64 lastEmittedTimestamp;
+    bool dropLatePackets;
+    bool hasEmitted;
+};
@@ -48,24 +48,110 @@ const char* getMIDI1MessageDescription(const byte* data, int length)
 }
 
 
-MIDI2Printer::MIDI2Printer()
+MIDI2Printer::MIDI2Printer(bool _autoFlush)
     : MIDI2Processor()
     , firstTimestamp(0)
+    , autoFlush(_autoFlush)
+    , bufferUsed(0)
 {
     // nothing
 }
 
-void MIDI2Printer::process(uint64 timestamp, const UMPacket &packet)
+MIDI2Printer::~MIDI2Printer()
 {
+    flush();
+}
+
+void MIDI2Printer::append(uint64 timestamp, const UMPacket &packet)
+{
+    // one line: timestamp, packet, newline
+    static const int MaxLineLength = 24 + UMPacket::MaxFormattedLength;
+    if (bufferUsed + MaxLineLength > BufferSize)
+    {
+        flush();
+    }
     if (firstTimestamp == 0)
     {
         firstTimestamp = timestamp;
     }
-    printf("%6llu: %s\n", (timestamp - firstTimestamp) / 1000000L, packet.toString());
+
+    // milliseconds, right aligned in 6 characters like printf("%6llu")
+    char digits[20];
+    int digitCount = 0;
+    uint64 millis = (timestamp - firstTimestamp) / 1000000L;
+    do
+    {
+        digits[digitCount++] = (char)('0' + millis % 10);
+        millis /= 10;
+    }
+    while (millis > 0);
+    char* out = buffer + bufferUsed;
+    for (int i = digitCount; i < 6; i++)
+    {
+        *out++ = ' ';
+    }
+    while (digitCount > 0)
+    {
+        *out++ = digits[--digitCount];
+    }
+    *out++ = ':';
+    *out++ = ' ';
+    out += packet.format(out, (size_t)(buffer + BufferSize - out));
+    *out++ = '\n';
+    bufferUsed = (int)(out - buffer);
+}
+
+void MIDI2Printer::process(uint64 timestamp, const UMPacket &packet)
+{
+    append(timestamp, packet);
+    if (autoFlush)
+    {
+        flush();
+    }
+}
+
+void MIDI2Printer::process(uint64 timestamp, UMPView packet)
+{
+    process(timestamp, UMPacket(packet));
+}
+
+void MIDI2Printer::processRawUMP(uint64 timestamp, const uint32* rawWords, int sizeInWords)
+{
+    bool wasAutoFlush = autoFlush;
+    autoFlush = false;
+    MIDI2Processor::processRawUMP(timestamp, rawWords, sizeInWords);
+    autoFlush = wasAutoFlush;
+    if (autoFlush)
+    {
+        flush();
+    }
+}
+
+void MIDI2Printer::processBlock(const UMPBlock& block)
+{
+    bool wasAutoFlush = autoFlush;
+    autoFlush = false;
+    MIDI2Processor::processBlock(block);
+    autoFlush = wasAutoFlush;
+    if (autoFlush)
+    {
+        flush();
+    }
+}
+
+void MIDI2Printer::flush()
+{
+    if (bufferUsed > 0)
+    {
+        fwrite(buffer, 1, (size_t)bufferUsed, stdout);
+        fflush(stdout);
+        bufferUsed = 0;
+    }
 }
 
 void MIDI2Printer::onCorruptRawData(const char* errorMessage)
 {
+    // keep the order of packets and errors
+    flush();
     fprintf(stderr, "%s\n", errorMessage);
 }
-
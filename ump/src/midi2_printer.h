@@ -26,21 +26,50 @@
 #include "midi2.h"
 
 
-/** Print received UMPackets to stdout. */
+/**
+ * Print received UMPackets to stdout.
+ *
+ * The lines are collected in a large buffer and written with one call per
+ * block. With auto flush (the default), the buffer is written at the end of
+ * every process(), processRawUMP() and processBlock() call. Without it,
+ * the buffer is only written when full, by flush(), and on destruction,
+ * which is best for tracing at full input rate.
+ *
+ * Either way, the writes block the calling thread: with auto flush, this
+ * is one fwrite() and fflush() per call. To keep a MIDI input thread free
+ * of I/O, receive into a MIDI2QueueWriter and run the printer behind a
+ * MIDI2QueueWorker.
+ */
 class MIDI2Printer
     : public MIDI2Processor
 {
 public:
+    static const int BufferSize = 65536;
+
+    MIDI2Printer(bool autoFlush = true);
+    ~MIDI2Printer();
     
-    MIDI2Printer();
-    
+    using MIDI2Processor::process;
+
     /** print a human-readable version of this packet to stdout */
     void process(uint64 timestamp, const UMPacket &packet) override;
+    void process(uint64 timestamp, UMPView packet) override;
+    void processRawUMP(uint64 timestamp, const uint32* rawWords, int sizeInWords) override;
+    void processBlock(const UMPBlock& block) override;
     
     /** print the error message to stderr */
     void onCorruptRawData(const char* errorMessage) override;
+
+    void setAutoFlush(bool autoFlush) { this->autoFlush = autoFlush; }
+
+    /** write the buffered lines to stdout */
+    void flush();
     
 private:
+    void append(uint64 timestamp, const UMPacket& packet);
+
     uint64 firstTimestamp;
+    bool autoFlush;
+    int bufferUsed;
+    char buffer[BufferSize];
 };
-
@@ -0,0 +1,223 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "midi2_queue.h"
+
+#include <chrono>
+
+
+//
+// MARK: MIDI2PacketQueue
+//
+
+MIDI2PacketQueue::MIDI2PacketQueue(int capacityInWords /* = 16384 */)
+    : writePos(0)
+    , readPos(0)
+    , droppedPackets(0)
+    , invalidPackets(0)
+{
+    // at least room for one maximum size packet
+    capacity = 8;
+    while ((int)capacity < capacityInWords && capacity < 0x40000000)
+    {
+        capacity <<= 1;
+    }
+    mask = capacity - 1;
+    buffer = new uint32[capacity];
+}
+
+
+MIDI2PacketQueue::~MIDI2PacketQueue()
+{
+    delete[] buffer;
+}
+
+
+bool MIDI2PacketQueue::write(uint64 timestamp, const uint32* words, int sizeInWords)
+{
+    if (words == nullptr || sizeInWords <= 0 || sizeInWords != UMPacket::wordToSize(words[0]))
+    {
+        // the reader could not find the next packet
+        invalidPackets.store(invalidPackets.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return false;
+    }
+    uint32 entrySize = TimestampWords + sizeInWords;
+    uint32 w = writePos.load(std::memory_order_relaxed);
+    uint32 r = readPos.load(std::memory_order_acquire);
+    if (capacity - (w - r) < entrySize)
+    {
+        droppedPackets.store(droppedPackets.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return false;
+    }
+    buffer[w & mask] = (uint32)timestamp;
+    buffer[(w + 1) & mask] = (uint32)(timestamp >> 32);
+    for (int i = 0; i < sizeInWords; i++)
+    {
+        buffer[(w + TimestampWords + i) & mask] = words[i];
+    }
+    // publish the whole packet at once
+    writePos.store(w + entrySize, std::memory_order_release);
+    return true;
+}
+
+
+bool MIDI2PacketQueue::read(uint64& timestamp, UMPacket& packet)
+{
+    uint32 r = readPos.load(std::memory_order_relaxed);
+    uint32 w = writePos.load(std::memory_order_acquire);
+    if (r == w)
+    {
+        return false;
+    }
+    timestamp = ((uint64)buffer[(r + 1) & mask] << 32) | buffer[r & mask];
+    int sizeInWords = UMPacket::wordToSize(buffer[(r + TimestampWords) & mask]);
+    for (int i = 0; i < sizeInWords; i++)
+    {
+        packet.setWord(i, buffer[(r + TimestampWords + i) & mask]);
+    }
+    readPos.store(r + TimestampWords + sizeInWords, std::memory_order_release);
+    return true;
+}
+
+
+int MIDI2PacketQueue::drain(MIDI2Processor& target, int maxPackets /* = 0x7FFFFFFF */)
+{
+    uint32 r = readPos.load(std::memory_order_relaxed);
+    uint32 w = writePos.load(std::memory_order_acquire);
+    if (r == w)
+    {
+        return 0;
+    }
+
+    UMPBlockBuffer block;
+    int count = 0;
+    while (r != w && count < maxPackets)
+    {
+        uint64 timestamp = ((uint64)buffer[(r + 1) & mask] << 32) | buffer[r & mask];
+        uint32 words[4];
+        int sizeInWords = UMPacket::wordToSize(buffer[(r + TimestampWords) & mask]);
+        for (int i = 0; i < sizeInWords; i++)
+        {
+            words[i] = buffer[(r + TimestampWords + i) & mask];
+        }
+        if (block.add(timestamp, words, sizeInWords) == 0)
+        {
+            // block is full: free the space in the queue, then pass on the block
+            readPos.store(r, std::memory_order_release);
+            target.processBlock(block.getBlock());
+            block.clear();
+            block.add(timestamp, words, sizeInWords);
+        }
+        r += TimestampWords + sizeInWords;
+        count++;
+    }
+    readPos.store(r, std::memory_order_release);
+    if (!block.isEmpty())
+    {
+        target.processBlock(block.getBlock());
+    }
+    return count;
+}
+
+
+bool MIDI2PacketQueue::isEmpty() const
+{
+    return readPos.load(std::memory_order_acquire) == writePos.load(std::memory_order_acquire);
+}
+
+
+//
+// MARK: MIDI2QueueWriter
+//
+
+MIDI2QueueWriter::MIDI2QueueWriter(MIDI2PacketQueue& _queue)
+    : MIDI2Processor()
+    , queue(_queue)
+{
+    // nothing
+}
+
+
+void MIDI2QueueWriter::process(uint64 timestamp, const UMPacket& packet)
+{
+    queue.write(timestamp, packet.getData(), packet.getSizeInWords());
+}
+
+
+void MIDI2QueueWriter::process(uint64 timestamp, UMPView packet)
+{
+    queue.write(timestamp, packet);
+}
+
+
+//
+// MARK: MIDI2QueueWorker
+//
+
+MIDI2QueueWorker::MIDI2QueueWorker()
+    : shouldStop(false)
+{
+    // nothing
+}
+
+
+MIDI2QueueWorker::~MIDI2QueueWorker()
+{
+    stop();
+}
+
+
+bool MIDI2QueueWorker::start(MIDI2PacketQueue& queue, MIDI2Processor& target, int idleSleepMicros /* = 500 */)
+{
+    if (isRunning())
+    {
+        return false;
+    }
+    shouldStop = false;
+    thread = std::thread(&MIDI2QueueWorker::run, this, &queue, &target, idleSleepMicros);
+    return true;
+}
+
+
+void MIDI2QueueWorker::stop()
+{
+    if (isRunning())
+    {
+        shouldStop = true;
+        thread.join();
+    }
+}
+
+
+void MIDI2QueueWorker::run(MIDI2PacketQueue* queue, MIDI2Processor* target, int idleSleepMicros)
+{
+    while (!shouldStop.load(std::memory_order_acquire))
+    {
+        if (queue->drain(*target) == 0)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(idleSleepMicros));
+        }
+    }
+    // process what's left
+    queue->drain(*target);
+}
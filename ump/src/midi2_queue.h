@@ -0,0 +1,146 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+
+#include "midi2.h"
+#include <atomic>
+#include <thread>
+
+
+/**
+ * A wait-free single-producer/single-consumer queue of timestamped UMP packets.
+ *
+ * Packets are stored as whole packets in word units: 2 words timestamp,
+ * followed by the 1..4 packet words. A packet only becomes visible to the
+ * reader once all of its words are written, so a read never returns a
+ * partial packet.
+ * Exactly one thread may write, and exactly one (other) thread may read.
+ */
+class MIDI2PacketQueue
+{
+public:
+    /** @param capacityInWords is rounded up to the next power of 2 */
+    MIDI2PacketQueue(int capacityInWords = 16384);
+    ~MIDI2PacketQueue();
+
+    // producer side
+
+    /**
+     * Append one packet. The reader derives the size from the message type,
+     * so sizeInWords must match it.
+     * @return false if there is not enough space, or if sizeInWords does not
+     *         match the message type (the packet is dropped)
+     */
+    bool write(uint64 timestamp, const uint32* words, int sizeInWords);
+    bool write(uint64 timestamp, UMPView packet) { return write(timestamp, packet.getData(), packet.getSizeInWords()); }
+
+    /** @return the number of packets dropped by write() because the queue was full */
+    uint32 getDroppedPacketCount() const { return droppedPackets.load(std::memory_order_relaxed); }
+
+    /** @return the number of packets rejected by write() because of a wrong size */
+    uint32 getInvalidPacketCount() const { return invalidPackets.load(std::memory_order_relaxed); }
+
+    // consumer side
+
+    /**
+     * Remove the oldest packet.
+     * @return false if the queue is empty
+     */
+    bool read(uint64& timestamp, UMPacket& packet);
+
+    /**
+     * Remove up to maxPackets packets and pass them on to the target
+     * as blocks via processBlock().
+     * @return the number of packets passed on
+     */
+    int drain(MIDI2Processor& target, int maxPackets = 0x7FFFFFFF);
+
+    // any thread
+
+    bool isEmpty() const;
+    int getCapacityInWords() const { return (int)capacity; }
+
+private:
+    /** number of words used by the timestamp in front of every packet */
+    static const int TimestampWords = 2;
+
+    uint32* buffer;
+    uint32 capacity;
+    uint32 mask;
+
+    // read and write positions increase monotonically, use & mask to access buffer.
+    // Keep them on separate cache lines to avoid false sharing.
+    alignas(64) std::atomic<uint32> writePos;
+    alignas(64) std::atomic<uint32> readPos;
+    alignas(64) std::atomic<uint32> droppedPackets;
+    std::atomic<uint32> invalidPackets;
+};
+
+
+/**
+ * The producer side adapter: a MIDI2Processor which writes all packets
+ * to a MIDI2PacketQueue. Use it as receiver for a MIDI input, so that
+ * the input thread only copies the packets.
+ */
+class MIDI2QueueWriter
+    : public MIDI2Processor
+{
+public:
+    MIDI2QueueWriter(MIDI2PacketQueue& queue);
+
+    void process(uint64 timestamp, const UMPacket& packet) override;
+    void process(uint64 timestamp, UMPView packet) override;
+
+private:
+    MIDI2PacketQueue& queue;
+};
+
+
+/**
+ * The consumer side: a worker thread which drains the queue
+ * into the target processor.
+ */
+class MIDI2QueueWorker
+{
+public:
+    MIDI2QueueWorker();
+    ~MIDI2QueueWorker();
+
+    /**
+     * start the worker thread.
+     * @param idleSleepMicros how long to sleep if the queue is empty
+     */
+    bool start(MIDI2PacketQueue& queue, MIDI2Processor& target, int idleSleepMicros = 500);
+
+    /** stop the worker thread, after it has drained the queue */
+    void stop();
+
+    bool isRunning() const { return thread.joinable(); }
+
+private:
+    void run(MIDI2PacketQueue* queue, MIDI2Processor* target, int idleSleepMicros);
+
+    std::thread thread;
+    std::atomic<bool> shouldStop;
+};
@@ -0,0 +1,245 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "midi2_router.h"
+
+//
+// MARK: Table
+//
+
+MIDI2Router::Table::Table(uint16 destinations)
+{
+    setAll(destinations);
+}
+
+
+void MIDI2Router::Table::setAll(uint16 destinations)
+{
+    for (int group = 0; group < 16; group++)
+    {
+        for (int channel = 0; channel < 16; channel++)
+        {
+            setChannelRoute(group, channel, destinations, group, channel);
+        }
+        setGroupRoute(group, destinations, group);
+    }
+}
+
+
+void MIDI2Router::Table::setChannelRoute(uint4 group, uint4 channel, uint16 destinations, uint4 toGroup, uint4 toChannel)
+{
+    Route& route = routes[((group & 0x0F) << 4) | (channel & 0x0F)];
+    route.destinations = destinations;
+    route.group = toGroup & 0x0F;
+    route.channel = toChannel & 0x0F;
+}
+
+
+void MIDI2Router::Table::setGroupRoute(uint4 group, uint16 destinations, uint4 toGroup)
+{
+    Route& route = routes[256 | (group & 0x0F)];
+    route.destinations = destinations;
+    route.group = toGroup & 0x0F;
+    route.channel = 0;
+}
+
+
+//
+// MARK: MIDI2Router
+//
+
+MIDI2Router::MIDI2Router()
+    : MIDI2Processor()
+    , destinations{}
+    , destinationCount(0)
+    , destinationMask(0)
+    , activeTable(&tables[0])
+    , routingTable(&tables[0])
+{
+}
+
+
+int MIDI2Router::addDestination(MIDI2Processor& destination)
+{
+    if (destinationCount >= MaxDestinations)
+    {
+        return -1;
+    }
+    destinations[destinationCount] = &destination;
+    destinationMask |= (uint16)(1 << destinationCount);
+    return destinationCount++;
+}
+
+
+void MIDI2Router::setTable(const Table& table)
+{
+    // use the table which is neither active nor possibly still in use for routing
+    const Table* active = activeTable.load();
+    const Table* routing = routingTable.load();
+    Table* spare = &tables[0];
+    while (spare == active || spare == routing)
+    {
+        spare++;
+    }
+    *spare = table;
+    activeTable.store(spare);
+}
+
+
+const MIDI2Router::Table* MIDI2Router::acquireTable()
+{
+    const Table* table = activeTable.load();
+    for (;;)
+    {
+        // announce the table, then check that it was not replaced in the meantime
+        routingTable.store(table);
+        const Table* active = activeTable.load();
+        if (active == table)
+        {
+            return table;
+        }
+        table = active;
+    }
+}
+
+
+void MIDI2Router::rewrite(const Route& route, UMPacket& packet)
+{
+    packet.setGroup(route.group);
+    UMPacket::MessageType type = packet.getMessageType();
+    if (type == UMPacket::M1ChannelVoice || type == UMPacket::M2ChannelVoice)
+    {
+        packet.setM2Channel(route.channel);
+    }
+}
+
+
+void MIDI2Router::process(uint64 timestamp, const UMPacket& packet)
+{
+    process(timestamp, UMPView(packet));
+}
+
+
+void MIDI2Router::process(uint64 timestamp, UMPView packet)
+{
+    const Route& route = acquireTable()->getRoute(packet.getWord1());
+    uint32 mask = route.destinations & destinationMask;
+    if (mask == 0)
+    {
+        return;
+    }
+    UMPacket rewritten(packet);
+    rewrite(route, rewritten);
+    while (mask != 0)
+    {
+        int index = getLowestBitIndex(mask);
+        mask &= mask - 1;
+        destinations[index]->process(timestamp, rewritten);
+    }
+}
+
+
+void MIDI2Router::routeToBlocks(const Table& table, uint64 timestamp, const uint32* words, int packetSize)
+{
+    const Route& route = table.getRoute(words[0]);
+    uint32 mask = route.destinations & destinationMask;
+    if (mask == 0)
+    {
+        return;
+    }
+    UMPacket rewritten(UMPView(words, packetSize));
+    rewrite(route, rewritten);
+    while (mask != 0)
+    {
+        int index = getLowestBitIndex(mask);
+        mask &= mask - 1;
+        UMPBlockBuffer& block = blocks[index];
+        if (block.add(timestamp, rewritten.getData(), packetSize) == 0)
+        {
+            destinations[index]->processBlock(block.getBlock());
+            block.clear();
+            block.add(timestamp, rewritten.getData(), packetSize);
+        }
+    }
+}
+
+
+void MIDI2Router::flushBlocks()
+{
+    for (int i = 0; i < destinationCount; i++)
+    {
+        if (!blocks[i].isEmpty())
+        {
+            destinations[i]->processBlock(blocks[i].getBlock());
+            blocks[i].clear();
+        }
+    }
+}
+
+
+void MIDI2Router::processRawUMP(uint64 timestamp, const uint32* rawWords, int sizeInWords)
+{
+    if (rawWords == nullptr)
+    {
+        return;
+    }
+    const Table& table = *acquireTable();
+    int complete = forEachCompletePacket(timestamp, rawWords, sizeInWords, [this, &table](uint64 ts, UMPView packet)
+    {
+        routeToBlocks(table, ts, packet.getData(), packet.getSizeInWords());
+    });
+    flushBlocks();
+    // after the routed packets, to keep the order of packets and errors
+    if (complete < sizeInWords)
+    {
+        onCorruptRawData("incomplete UMP received.");
+    }
+}
+
+
+void MIDI2Router::processBlock(const UMPBlock& block)
+{
+    if (block.getWords() == nullptr)
+    {
+        return;
+    }
+    const Table& table = *acquireTable();
+    int complete = forEachCompletePacket(block, [this, &table](uint64 ts, UMPView packet)
+    {
+        routeToBlocks(table, ts, packet.getData(), packet.getSizeInWords());
+    });
+    flushBlocks();
+    if (complete < block.getSizeInWords())
+    {
+        onCorruptRawData("incomplete UMP received.");
+    }
+}
+
+
+void MIDI2Router::onCorruptRawData(const char* errorMessage)
+{
+    for (int i = 0; i < destinationCount; i++)
+    {
+        destinations[i]->onCorruptRawData(errorMessage);
+    }
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+
+#include <atomic>
+#include "midi2.h"
+
+
+/**
+ * Route packets to a number of destination processors, rewriting
+ * group and channel on the way.
+ *
+ * The routing is defined by a Table: for MIDI 1.0 and MIDI 2.0 channel voice
+ * messages, one route per group and channel; for all other messages, one
+ * route per group. A route names the destinations (one bit per destination)
+ * and the group and channel written into the packet.
+ *
+ * The table can be changed with setTable() while packets are being routed on
+ * another thread: the new table is copied into a spare buffer and published
+ * atomically, so the routing thread never waits for a lock.
+ * Destinations must be added before routing starts.
+ */
+class MIDI2Router
+    : public MIDI2Processor
+{
+public:
+    static const int MaxDestinations = 16;
+
+    struct Route
+    {
+        /** one bit per destination index */
+        uint16 destinations;
+        uint4 group;
+        uint4 channel;
+    };
+
+    class Table
+    {
+    public:
+        /** create a table which routes all packets unchanged to the given destinations */
+        Table(uint16 destinations = 0);
+
+        /** route all packets unchanged to the given destinations */
+        void setAll(uint16 destinations);
+
+        /** set the route for channel voice messages on this group and channel */
+        void setChannelRoute(uint4 group, uint4 channel, uint16 destinations, uint4 toGroup, uint4 toChannel);
+
+        /** set the route for all messages without channel on this group */
+        void setGroupRoute(uint4 group, uint16 destinations, uint4 toGroup);
+
+        const Route& getRoute(uint32 word1) const
+        {
+            uint32 type = word1 >> 28;
+            bool hasChannel = ((1 << UMPacket::M1ChannelVoice | 1 << UMPacket::M2ChannelVoice) >> type) & 1;
+            uint32 index = hasChannel ? (((word1 >> 20) & 0xF0) | ((word1 >> 16) & 0x0F)) : (256 | ((word1 >> 24) & 0x0F));
+            return routes[index];
+        }
+
+    private:
+        /** 16 groups x 16 channels, followed by 16 groups for messages without channel */
+        Route routes[256 + 16];
+    };
+
+    MIDI2Router();
+
+    /** @return the destination index, or -1 if no more destinations can be added */
+    int addDestination(MIDI2Processor& destination);
+    int getDestinationCount() const { return destinationCount; }
+
+    /**
+     * Use a new routing table. Can be called while packets are routed on
+     * another thread, but only from one thread at a time.
+     */
+    void setTable(const Table& table);
+
+    void process(uint64 timestamp, const UMPacket& packet) override;
+    void process(uint64 timestamp, UMPView packet) override;
+    void processRawUMP(uint64 timestamp, const uint32* rawWords, int sizeInWords) override;
+    void processBlock(const UMPBlock& block) override;
+    /** passed on to all destinations */
+    void onCorruptRawData(const char* errorMessage) override;
+
+private:
+    /** get the current table and mark it as in use by the routing thread */
+    const Table* acquireTable();
+    static void rewrite(const Route& route, UMPacket& packet);
+    void routeToBlocks(const Table& table, uint64 timestamp, const uint32* words, int packetSize);
+    void flushBlocks();
+
+    MIDI2Processor* destinations[MaxDestinations];
+    int destinationCount;
+    uint16 destinationMask;
+
+    /** the active table, the table in use by the routing thread, and a spare one */
+    Table tables[3];
+    std::atomic<const Table*> activeTable;
+    std::atomic<const Table*> routingTable;
+
+    /** used by processRawUMP() and processBlock() to collect the packets per destination */
+    UMPBlockBuffer blocks[MaxDestinations];
+};
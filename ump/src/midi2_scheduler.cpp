@@ -0,0 +1,330 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "midi2_scheduler.h"
+
+#include <algorithm>
+
+
+MIDI2Scheduler::MIDI2Scheduler(MIDI2Processor& _sink, uint64 _tickDuration, int capacity /* = 4096 */)
+    : sink(_sink)
+    , tickDuration(_tickDuration > 0 ? _tickDuration : 1)
+    , currentTick(0)
+    , started(false)
+    , entries(capacity > 0 ? capacity : 1)
+    , freeList(-1)
+    , pendingCount(0)
+{
+    for (int i = 0; i < ListCount; i++)
+    {
+        lists[i] = -1;
+    }
+    // all entries are free
+    for (int i = (int)entries.size() - 1; i >= 0; i--)
+    {
+        entries[i].next = freeList;
+        freeList = i;
+    }
+    batch.reserve(entries.size());
+}
+
+
+void MIDI2Scheduler::reset(uint64 now)
+{
+    uint64 tick = now / tickDuration;
+    currentTick = tick;
+    started = true;
+    // re-sort everything into the wheel relative to the new current tick
+    for (int list = 0; list < ListCount; list++)
+    {
+        relink(list);
+    }
+}
+
+
+void MIDI2Scheduler::link(int index)
+{
+    Entry& e = entries[index];
+    int list;
+    if (e.dueTick <= currentTick)
+    {
+        list = ReadyList;
+    }
+    else
+    {
+        uint64 delta = e.dueTick - currentTick;
+        list = OverflowList;
+        for (int level = 0; level < LevelCount; level++)
+        {
+            if (delta < ((uint64)1 << (SlotBits * (level + 1))))
+            {
+                list = level * SlotCount + (int)((e.dueTick >> (SlotBits * level)) & SlotMask);
+                break;
+            }
+        }
+    }
+    e.list = list;
+    e.prev = -1;
+    e.next = lists[list];
+    if (e.next >= 0)
+    {
+        entries[e.next].prev = index;
+    }
+    lists[list] = index;
+}
+
+
+void MIDI2Scheduler::unlink(int index)
+{
+    Entry& e = entries[index];
+    if (e.prev >= 0)
+    {
+        entries[e.prev].next = e.next;
+    }
+    else
+    {
+        lists[e.list] = e.next;
+    }
+    if (e.next >= 0)
+    {
+        entries[e.next].prev = e.prev;
+    }
+    e.list = -1;
+    e.prev = -1;
+    e.next = -1;
+}
+
+
+MIDI2Scheduler::Handle MIDI2Scheduler::insert(uint64 dueTime, const UMPacket& packet)
+{
+    if (freeList < 0)
+    {
+        return InvalidHandle;
+    }
+    int index = freeList;
+    Entry& e = entries[index];
+    freeList = e.next;
+
+    e.packet = packet;
+    e.dueTime = dueTime;
+    e.dueTick = dueTime / tickDuration;
+    e.generation++;
+    if (!started)
+    {
+        // start the wheel at the first due time, not at 0
+        currentTick = e.dueTick;
+        started = true;
+    }
+    link(index);
+    pendingCount++;
+    return (((Handle)e.generation) << 32) | (Handle)(index + 1);
+}
+
+
+bool MIDI2Scheduler::cancel(Handle handle)
+{
+    int index = (int)(handle & 0xFFFFFFFF) - 1;
+    if (index < 0 || index >= (int)entries.size())
+    {
+        return false;
+    }
+    Entry& e = entries[index];
+    if (e.list < 0 || e.generation != (uint32)(handle >> 32))
+    {
+        // already released or cancelled
+        return false;
+    }
+    unlink(index);
+    e.next = freeList;
+    freeList = index;
+    pendingCount--;
+    return true;
+}
+
+
+void MIDI2Scheduler::relink(int list)
+{
+    int index = lists[list];
+    lists[list] = -1;
+    while (index >= 0)
+    {
+        int next = entries[index].next;
+        link(index);
+        index = next;
+    }
+}
+
+
+void MIDI2Scheduler::release(int list, uint64 now)
+{
+    int index = lists[list];
+    lists[list] = -1;
+    while (index >= 0)
+    {
+        Entry& e = entries[index];
+        int next = e.next;
+        if (e.dueTime <= now)
+        {
+            e.list = -1;
+            batch.push_back(index);
+        }
+        else
+        {
+            // due later within the current tick
+            link(index);
+        }
+        index = next;
+    }
+}
+
+
+void MIDI2Scheduler::flushBatch(uint64 now)
+{
+    if (batch.empty())
+    {
+        return;
+    }
+    // one tick can contain several due times: release in due time order.
+    // The batch is collected tick by tick, so it is nearly sorted: an
+    // in-place insertion sort is fast, stable, and does not allocate
+    // (std::stable_sort may allocate a temporary buffer).
+    for (size_t i = 1; i < batch.size(); i++)
+    {
+        int index = batch[i];
+        uint64 dueTime = entries[index].dueTime;
+        size_t j = i;
+        while (j > 0 && entries[batch[j - 1]].dueTime > dueTime)
+        {
+            batch[j] = batch[j - 1];
+            j--;
+        }
+        batch[j] = index;
+    }
+
+    block.clear();
+    for (int index : batch)
+    {
+        Entry& e = entries[index];
+        const uint32* words = e.packet.getData();
+        int sizeInWords = e.packet.getSizeInWords();
+        if (block.add(e.dueTime, words, sizeInWords) == 0)
+        {
+            sink.processBlock(block.getBlock());
+            block.clear();
+            block.add(e.dueTime, words, sizeInWords);
+        }
+
+        uint64 lateness = (now > e.dueTime) ? (now - e.dueTime) : 0;
+        latenessStats.releasedPackets++;
+        latenessStats.lastLateness = lateness;
+        latenessStats.totalLateness += lateness;
+        if (lateness > latenessStats.maxLateness)
+        {
+            latenessStats.maxLateness = lateness;
+        }
+
+        e.next = freeList;
+        freeList = index;
+        pendingCount--;
+    }
+    if (!block.isEmpty())
+    {
+        sink.processBlock(block.getBlock());
+        block.clear();
+    }
+    batch.clear();
+}
+
+
+uint64 MIDI2Scheduler::getNextEventTick() const
+{
+    // level 0 slots are released at their tick, higher level slots
+    // are cascaded when the tick reaches the start of the slot
+    uint64 next = ~(uint64)0;
+    for (int level = 0; level < LevelCount; level++)
+    {
+        int shift = SlotBits * level;
+        uint64 base = currentTick >> shift;
+        for (uint64 k = 1; k <= (uint64)SlotCount; k++)
+        {
+            if (lists[level * SlotCount + (int)((base + k) & SlotMask)] >= 0)
+            {
+                next = std::min(next, (base + k) << shift);
+                break;
+            }
+        }
+    }
+    if (lists[OverflowList] >= 0)
+    {
+        int shift = SlotBits * LevelCount;
+        next = std::min(next, ((currentTick >> shift) + 1) << shift);
+    }
+    return next;
+}
+
+
+int MIDI2Scheduler::advance(uint64 now)
+{
+    uint64 targetTick = now / tickDuration;
+    if (!started)
+    {
+        currentTick = targetTick;
+        started = true;
+    }
+
+    release(ReadyList, now);
+    while (currentTick < targetTick)
+    {
+        // skip the ticks with empty slots
+        uint64 nextTick = (pendingCount == (int)batch.size()) ? ~(uint64)0 : getNextEventTick();
+        if (nextTick > targetTick)
+        {
+            currentTick = targetTick;
+            break;
+        }
+        currentTick = nextTick;
+        // find the levels which wrapped around with this tick
+        int level = 1;
+        while (level < LevelCount && (currentTick & (((uint64)1 << (SlotBits * level)) - 1)) == 0)
+        {
+            level++;
+        }
+        if (level == LevelCount && (currentTick & (((uint64)1 << (SlotBits * LevelCount)) - 1)) == 0)
+        {
+            // the top level wrapped: bring in the entries which were out of range
+            relink(OverflowList);
+        }
+        // cascade from the highest level down
+        for (level--; level > 0; level--)
+        {
+            relink(level * SlotCount + (int)((currentTick >> (SlotBits * level)) & SlotMask));
+        }
+        release((int)(currentTick & SlotMask), now);
+        // cascaded entries may be due right now
+        release(ReadyList, now);
+    }
+
+    int count = (int)batch.size();
+    flushBatch(now);
+    return count;
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+
+#include "midi2.h"
+#include <vector>
+
+
+/**
+ * Schedule packets for sending at a future timestamp.
+ *
+ * Packets are kept in a hierarchical timing wheel (4 levels of 256 slots),
+ * so insert() and cancel() take constant time and do not allocate.
+ * advance() releases all packets which are due to the sink as UMPBlocks,
+ * with the due time as packet timestamp, and records how late each packet
+ * was released.
+ *
+ * Not thread safe: call all methods from the same thread.
+ */
+class MIDI2Scheduler
+{
+public:
+    typedef uint64 Handle;
+    static const Handle InvalidHandle = 0;
+
+    struct LatenessStats
+    {
+        uint64 releasedPackets = 0;
+        /** lateness of the last released packet */
+        uint64 lastLateness = 0;
+        uint64 maxLateness = 0;
+        /** sum of all lateness values, divide by releasedPackets for the average */
+        uint64 totalLateness = 0;
+    };
+
+    /**
+     * @param sink receives the due packets
+     * @param tickDuration resolution of the wheel, in timestamp units
+     * @param capacity maximum number of scheduled packets
+     */
+    MIDI2Scheduler(MIDI2Processor& sink, uint64 tickDuration, int capacity = 4096);
+
+    /**
+     * Set the current time. Packets due before this time will be released
+     * with the next call to advance(). Optional: without it, the wheel starts
+     * at the first insert() or advance().
+     */
+    void reset(uint64 now);
+
+    /**
+     * Schedule the packet for sending at dueTime.
+     * @return a handle for cancel(), or InvalidHandle if the scheduler is full
+     */
+    Handle insert(uint64 dueTime, const UMPacket& packet);
+
+    /** @return true if the packet was still scheduled */
+    bool cancel(Handle handle);
+
+    /**
+     * Release all packets with dueTime <= now to the sink.
+     * @return the number of released packets
+     */
+    int advance(uint64 now);
+
+    int getPendingCount() const { return pendingCount; }
+
+    const LatenessStats& getLatenessStats() const { return latenessStats; }
+    void resetLatenessStats() { latenessStats = LatenessStats(); }
+
+private:
+    static const int LevelCount = 4;
+    static const int SlotBits = 8;
+    static const int SlotCount = 1 << SlotBits;
+    static const int SlotMask = SlotCount - 1;
+    /** list of entries which are due at the next advance() */
+    static const int ReadyList = LevelCount * SlotCount;
+    /** list of entries too far in the future for the wheel */
+    static const int OverflowList = ReadyList + 1;
+    static const int ListCount = OverflowList + 1;
+
+    struct Entry
+    {
+        UMPacket packet;
+        uint64 dueTime = 0;
+        uint64 dueTick = 0;
+        uint32 generation = 0;
+        int list = -1;
+        int prev = -1;
+        int next = -1;
+    };
+
+    void link(int index);
+    void unlink(int index);
+    /** move all entries of the list to the list matching their due tick */
+    void relink(int list);
+    /** move all entries of the list which are due at now to the batch */
+    void release(int list, uint64 now);
+    /** @return the next tick after currentTick at which a slot is released or cascaded */
+    uint64 getNextEventTick() const;
+    void flushBatch(uint64 now);
+
+    MIDI2Processor& sink;
+    uint64 tickDuration;
+    uint64 currentTick;
+    /** false until the wheel was set to a time by reset(), insert() or advance() */
+    bool started;
+    std::vector<Entry> entries;
+    int freeList;
+    int pendingCount;
+    int lists[ListCount];
+
+    /** entry indexes released in the current advance() */
+    std::vector<int> batch;
+    UMPBlockBuffer block;
+    LatenessStats latenessStats;
+};
@@ -0,0 +1,510 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "midi2_smf.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SMF_DEFAULT_TEMPO  (500000)
+#define SMF_META_EVENT     (0xFF)
+#define SMF_META_TEMPO     (0x51)
+#define SMF_META_END       (0x2F)
+
+
+static uint32 readBigEndian(const byte* p, int bytes)
+{
+    uint32 value = 0;
+    for (int i = 0; i < bytes; i++)
+    {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+
+/** read a variable length quantity, @return false if it does not end before end */
+static bool readVariableLength(const byte*& pos, const byte* end, uint32& value)
+{
+    value = 0;
+    for (int i = 0; i < 4 && pos < end; i++)
+    {
+        byte b = *pos++;
+        value = (value << 7) | (b & 0x7F);
+        if ((b & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+//
+// MARK: TranslatorListener
+//
+
+void MIDI2SMFReader::TranslatorListener::translatedMessage(const UMPacket& packet)
+{
+    if (target != nullptr)
+    {
+        target->process(timestamp, packet);
+    }
+}
+
+
+void MIDI2SMFReader::TranslatorListener::translatedMessage(const byte* data, int length, uint4 midi2Group)
+{
+    // only MIDI 1.0 to MIDI 2.0 translation is used
+    (void)data;
+    (void)length;
+    (void)midi2Group;
+}
+
+
+//
+// MARK: MIDI2SMFReader
+//
+
+MIDI2SMFReader::MIDI2SMFReader()
+    : data(nullptr)
+    , size(0)
+    , format(0)
+    , division(0)
+    , smpte(false)
+    , group(0)
+    , corruptTracks(0)
+    , tempoTick(0)
+    , tempoTimestamp(0)
+    , microsPerQuarter(SMF_DEFAULT_TEMPO)
+    , translator(&listener)
+{
+}
+
+
+MIDI2SMFReader::~MIDI2SMFReader()
+{
+    close();
+}
+
+
+bool MIDI2SMFReader::open(const char* path)
+{
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 14)
+    {
+        ::close(fd);
+        return false;
+    }
+    void* mapped = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        return false;
+    }
+    data = (const byte*)mapped;
+    size = (size_t)st.st_size;
+    madvise((void*)data, size, MADV_SEQUENTIAL);
+
+    // header chunk
+    uint32 headerLength = readBigEndian(data + 4, 4);
+    if (readBigEndian(data, 4) != 0x4D546864 /*MThd*/ || headerLength < 6 || 8 + (size_t)headerLength > size)
+    {
+        close();
+        return false;
+    }
+    format = (int)readBigEndian(data + 8, 2);
+    if (format > 1)
+    {
+        // format 2 tracks are independent sequences, they must not be merged
+        close();
+        return false;
+    }
+    int trackCount = (int)readBigEndian(data + 10, 2);
+    uint32 divisionWord = readBigEndian(data + 12, 2);
+    if (divisionWord & 0x8000)
+    {
+        // SMPTE: frames per second (negative) and ticks per frame
+        int fps = -(int)(int8)(divisionWord >> 8);
+        division = fps * (int)(divisionWord & 0xFF);
+        smpte = true;
+    }
+    else
+    {
+        division = (int)divisionWord;
+        smpte = false;
+    }
+    if (division <= 0)
+    {
+        close();
+        return false;
+    }
+
+    // find the track chunks, skipping unknown chunks
+    size_t offset = 8 + headerLength;
+    while (offset + 8 <= size && (int)tracks.size() < trackCount)
+    {
+        uint32 chunkLength = readBigEndian(data + offset + 4, 4);
+        const byte* chunkData = data + offset + 8;
+        size_t chunkEnd = std::min(offset + 8 + (size_t)chunkLength, size);
+        if (readBigEndian(data + offset, 4) == 0x4D54726B /*MTrk*/)
+        {
+            Track track;
+            track.start = chunkData;
+            track.pos = chunkData;
+            track.end = data + chunkEnd;
+            track.nextTick = 0;
+            track.runningStatus = 0;
+            track.inSysEx = false;
+            tracks.push_back(track);
+        }
+        offset = chunkEnd;
+    }
+    heap.reserve(tracks.size());
+    rewind();
+    return true;
+}
+
+
+void MIDI2SMFReader::close()
+{
+    if (data != nullptr)
+    {
+        munmap((void*)data, size);
+        data = nullptr;
+        size = 0;
+    }
+    tracks.clear();
+    heap.clear();
+}
+
+
+void MIDI2SMFReader::setGroup(uint4 _group)
+{
+    group = _group & 0x0F;
+    translator.setTranslateToMIDI2Group(group);
+}
+
+
+bool MIDI2SMFReader::isBefore(int a, int b) const
+{
+    if (tracks[a].nextTick != tracks[b].nextTick)
+    {
+        return tracks[a].nextTick < tracks[b].nextTick;
+    }
+    return a < b;
+}
+
+
+void MIDI2SMFReader::rewind()
+{
+    heap.clear();
+    corruptTracks = 0;
+    tempoTick = 0;
+    tempoTimestamp = 0;
+    microsPerQuarter = SMF_DEFAULT_TEMPO;
+    for (int i = 0; i < (int)tracks.size(); i++)
+    {
+        Track& track = tracks[i];
+        track.pos = track.start;
+        track.nextTick = 0;
+        track.runningStatus = 0;
+        track.inSysEx = false;
+        track.sysEx.clear();
+        if (readDeltaTime(track))
+        {
+            heap.push_back(i);
+        }
+    }
+    // std::make_heap builds a max-heap, so invert the order
+    std::make_heap(heap.begin(), heap.end(), [this](int a, int b) { return isBefore(b, a); });
+}
+
+
+bool MIDI2SMFReader::readDeltaTime(Track& track)
+{
+    if (track.pos >= track.end)
+    {
+        // the track ends without End of Track meta event
+        corruptTracks++;
+        return false;
+    }
+    uint32 delta;
+    if (!readVariableLength(track.pos, track.end, delta) || track.pos >= track.end)
+    {
+        // no event after the delta time
+        corruptTracks++;
+        return false;
+    }
+    track.nextTick += delta;
+    return true;
+}
+
+
+uint64 MIDI2SMFReader::tickToTimestamp(uint64 tick) const
+{
+    if (smpte)
+    {
+        // division is ticks per second
+        return tick * 1000000000ULL / (uint64)division;
+    }
+    return tempoTimestamp + (tick - tempoTick) * microsPerQuarter * 1000ULL / (uint64)division;
+}
+
+
+uint64 MIDI2SMFReader::getNextTimestamp() const
+{
+    if (heap.empty())
+    {
+        return ~(uint64)0;
+    }
+    return tickToTimestamp(tracks[heap.front()].nextTick);
+}
+
+
+bool MIDI2SMFReader::readEvent(Track& track)
+{
+    const byte* end = track.end;
+    if (track.pos >= end)
+    {
+        corruptTracks++;
+        return false;
+    }
+    byte status = *track.pos;
+    if (status & 0x80)
+    {
+        track.pos++;
+    }
+    else
+    {
+        // running status
+        status = track.runningStatus;
+        if (status == 0)
+        {
+            corruptTracks++;
+            return false;
+        }
+    }
+
+    if (status < MIDI_SYSTEMMESSAGE)
+    {
+        track.runningStatus = status;
+        int dataLength = (status >= MIDI_PROGRAMCHANGE && status < MIDI_PITCHBEND) ? 1 : 2;
+        if (track.pos + dataLength > end)
+        {
+            corruptTracks++;
+            return false;
+        }
+        byte message[3] = { status, track.pos[0], (byte)(dataLength == 2 ? track.pos[1] : 0) };
+        track.pos += dataLength;
+        translator.midi1Received(message, 1 + dataLength);
+        return true;
+    }
+
+    // system messages cancel running status
+    track.runningStatus = 0;
+    uint32 length;
+    if (status == SMF_META_EVENT)
+    {
+        if (track.pos >= end)
+        {
+            corruptTracks++;
+            return false;
+        }
+        byte type = *track.pos++;
+        if (!readVariableLength(track.pos, end, length) || track.pos + length > end)
+        {
+            corruptTracks++;
+            return false;
+        }
+        const byte* metaData = track.pos;
+        track.pos += length;
+        if (type == SMF_META_END)
+        {
+            return false;
+        }
+        if (type == SMF_META_TEMPO && length == 3 && !smpte)
+        {
+            tempoTimestamp = tickToTimestamp(track.nextTick);
+            tempoTick = track.nextTick;
+            microsPerQuarter = readBigEndian(metaData, 3);
+        }
+        return true;
+    }
+    if (status == MIDI_BEGINSYSEX || status == MIDI_SYSEX_CONT)
+    {
+        if (!readVariableLength(track.pos, end, length) || track.pos + length > end)
+        {
+            corruptTracks++;
+            return false;
+        }
+        const byte* bytes = track.pos;
+        track.pos += length;
+        readSysEx(track, status, bytes, (int)length);
+        return true;
+    }
+    // other status bytes are not allowed in a track
+    corruptTracks++;
+    return false;
+}
+
+
+void MIDI2SMFReader::readSysEx(Track& track, byte status, const byte* bytes, int length)
+{
+    bool complete = (length > 0 && bytes[length - 1] == MIDI_ENDSYSEX);
+    if (status == MIDI_BEGINSYSEX)
+    {
+        // a new message: an unfinished one is dropped
+        track.sysEx.clear();
+        track.inSysEx = !complete;
+        if (complete)
+        {
+            sendSysEx(bytes, length - 1);
+        }
+        else
+        {
+            track.sysEx.assign(bytes, bytes + length);
+        }
+        return;
+    }
+    if (!track.inSysEx)
+    {
+        // F7 outside of a SysEx message: escaped raw MIDI bytes
+        sendEscaped(bytes, length);
+        return;
+    }
+    // F7 continuation of a divided message, sent as a whole at its end
+    track.sysEx.insert(track.sysEx.end(), bytes, bytes + (complete ? length - 1 : length));
+    if (complete)
+    {
+        track.inSysEx = false;
+        sendSysEx(track.sysEx.data(), (int)track.sysEx.size());
+        track.sysEx.clear();
+    }
+}
+
+
+void MIDI2SMFReader::sendSysEx(const byte* sysex, int length)
+{
+    sysExWords.resize((size_t)MIDI2SysEx7Encoder::getSizeInWords(length));
+    int sizeInWords = MIDI2SysEx7Encoder::encode(group, sysex, length, sysExWords.data(), (int)sysExWords.size());
+    if (sizeInWords > 0)
+    {
+        listener.target->processRawUMP(listener.timestamp, sysExWords.data(), sizeInWords);
+    }
+}
+
+
+void MIDI2SMFReader::sendEscaped(const byte* bytes, int length)
+{
+    int pos = 0;
+    while (pos < length)
+    {
+        byte status = bytes[pos];
+        int messageLength;
+        if (status < 0x80)
+        {
+            // stray data byte
+            pos++;
+            continue;
+        }
+        if (status < MIDI_SYSTEMMESSAGE)
+        {
+            messageLength = (status >= MIDI_PROGRAMCHANGE && status < MIDI_PITCHBEND) ? 2 : 3;
+        }
+        else if (status == MIDI_MTCQUARTERFRAME || status == MIDI_SONGSELECT)
+        {
+            messageLength = 2;
+        }
+        else if (status == MIDI_SONGPOSPTR)
+        {
+            messageLength = 3;
+        }
+        else if (status == MIDI_BEGINSYSEX || status == MIDI_ENDSYSEX)
+        {
+            // SysEx bytes cannot be escaped into UMP
+            pos++;
+            continue;
+        }
+        else
+        {
+            messageLength = 1;
+        }
+        if (pos + messageLength > length)
+        {
+            return;
+        }
+        const byte* message = bytes + pos;
+        if (status < MIDI_SYSTEMMESSAGE)
+        {
+            translator.midi1Received(message, messageLength);
+        }
+        else
+        {
+            // System Common and Real Time messages map to message type 1
+            uint32 word = (((uint32)UMPacket::System) << 28)
+                | (((uint32)group & 0x0F) << 24)
+                | ((uint32)status << 16)
+                | ((messageLength > 1 ? (uint32)(message[1] & 0x7F) : 0) << 8)
+                | (messageLength > 2 ? (uint32)(message[2] & 0x7F) : 0);
+            listener.target->process(listener.timestamp, UMPacket(word));
+        }
+        pos += messageLength;
+    }
+}
+
+
+bool MIDI2SMFReader::process(MIDI2Processor& target, uint64 endTimestamp)
+{
+    listener.target = &target;
+    auto later = [this](int a, int b) { return isBefore(b, a); };
+    while (!heap.empty())
+    {
+        int trackIndex = heap.front();
+        Track& track = tracks[trackIndex];
+        uint64 timestamp = tickToTimestamp(track.nextTick);
+        if (timestamp >= endTimestamp)
+        {
+            break;
+        }
+        std::pop_heap(heap.begin(), heap.end(), later);
+        heap.pop_back();
+
+        listener.timestamp = timestamp;
+        if (readEvent(track) && readDeltaTime(track))
+        {
+            heap.push_back(trackIndex);
+            std::push_heap(heap.begin(), heap.end(), later);
+        }
+    }
+    listener.target = nullptr;
+    return !heap.empty();
+}
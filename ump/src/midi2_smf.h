@@ -0,0 +1,145 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+
+#include "midi2.h"
+#include "midi2_sysex.h"
+#include "midi2_translation.h"
+#include <stddef.h>
+#include <vector>
+
+
+/**
+ * Convert a Standard MIDI File to UMP packets, without loading it.
+ *
+ * The file is mapped into memory. All tracks are read in parallel and
+ * merged by tick, events at the same tick in track order. Ticks are
+ * converted to nanoseconds using the tempo changes seen so far. The MIDI 1.0
+ * channel messages are translated to MIDI 2.0 by a MIDI2Translator, System
+ * Exclusive messages are sent as SysEx7 packets, and escaped (F7) events as
+ * the MIDI 1.0 messages they contain. All packets go directly to the target
+ * processor; memory use only depends on the number of tracks and the size
+ * of SysEx messages divided into several events.
+ *
+ * Format 2 files (independent sequences) are not supported.
+ */
+class MIDI2SMFReader
+{
+public:
+    MIDI2SMFReader();
+    ~MIDI2SMFReader();
+
+    /** @return false if the file cannot be mapped, or is not a Standard MIDI File of format 0 or 1 */
+    bool open(const char* path);
+    void close();
+    bool isOpen() const { return data != nullptr; }
+
+    int getFormat() const { return format; }
+    int getTrackCount() const { return (int)tracks.size(); }
+    /** @return ticks per quarter note, or ticks per second for SMPTE files */
+    int getDivision() const { return division; }
+
+    /** set the group of the generated packets */
+    void setGroup(uint4 group);
+
+    /** start again at the beginning of the file */
+    void rewind();
+
+    /**
+     * Send all events with a timestamp before endTimestamp to the target.
+     * @param endTimestamp in nanoseconds from the start of the file
+     * @return false when the end of the file was reached
+     */
+    bool process(MIDI2Processor& target, uint64 endTimestamp);
+
+    /** send all remaining events to the target */
+    void processAll(MIDI2Processor& target) { process(target, ~(uint64)0); }
+
+    /** @return the timestamp of the next event in nanoseconds */
+    uint64 getNextTimestamp() const;
+
+    /** @return the number of corrupt tracks which were stopped early */
+    int getCorruptTrackCount() const { return corruptTracks; }
+
+private:
+    struct Track
+    {
+        const byte* start;
+        const byte* pos;
+        const byte* end;
+        uint64 nextTick;
+        byte runningStatus;
+        /** a SysEx message divided into several events: the bytes so far */
+        bool inSysEx;
+        std::vector<byte> sysEx;
+    };
+
+    /** passes translated packets on to the current target */
+    class TranslatorListener
+        : public MIDI2Translator::Listener
+    {
+    public:
+        void translatedMessage(const UMPacket& packet) override;
+        void translatedMessage(const byte* data, int length, uint4 midi2Group) override;
+
+        MIDI2Processor* target = nullptr;
+        uint64 timestamp = 0;
+    };
+
+    /** @return true if the next event of track a comes before the one of track b */
+    bool isBefore(int a, int b) const;
+    /** read the delta time of the next event, @return false at the end of the track */
+    bool readDeltaTime(Track& track);
+    /** handle the next event of the track, @return false at the end of the track */
+    bool readEvent(Track& track);
+    /** handle the data of an F0 or F7 event */
+    void readSysEx(Track& track, byte status, const byte* bytes, int length);
+    void sendSysEx(const byte* sysex, int length);
+    /** send the MIDI 1.0 messages of an escaped F7 event */
+    void sendEscaped(const byte* bytes, int length);
+    uint64 tickToTimestamp(uint64 tick) const;
+
+    const byte* data;
+    size_t size;
+    int format;
+    int division;
+    bool smpte;
+    uint4 group;
+    int corruptTracks;
+
+    std::vector<Track> tracks;
+    /** indices of tracks with more events, as a heap by next tick */
+    std::vector<int> heap;
+
+    // tempo map state
+    uint64 tempoTick;
+    uint64 tempoTimestamp;
+    uint32 microsPerQuarter;
+
+    /** the packets of one SysEx message */
+    std::vector<uint32> sysExWords;
+
+    MIDI2Translator translator;
+    TranslatorListener listener;
+};
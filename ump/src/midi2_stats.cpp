@@ -0,0 +1,178 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "midi2_stats.h"
+
+// the windows for rates, in seconds
+static const int rateWindows[3] = { 1, 10, 60 };
+
+
+uint64 MIDI2Stats::Snapshot::getMessageTypeCount(int messageType) const
+{
+    uint64 sum = 0;
+    const uint64* c = &counts[messageType << 12];
+    for (int i = 0; i < 4096; i++)
+    {
+        sum += c[i];
+    }
+    return sum;
+}
+
+
+uint64 MIDI2Stats::Snapshot::getGroupCount(int group) const
+{
+    uint64 sum = 0;
+    for (int type = 0; type < 16; type++)
+    {
+        const uint64* c = &counts[(type << 12) | (group << 8)];
+        for (int i = 0; i < 256; i++)
+        {
+            sum += c[i];
+        }
+    }
+    return sum;
+}
+
+
+MIDI2Stats::MIDI2Stats(MIDI2Processor* _downstream, uint64 _timestampUnitsPerSecond)
+    : MIDI2Processor()
+    , downstream(_downstream)
+    , timestampUnitsPerSecond(_timestampUnitsPerSecond > 0 ? _timestampUnitsPerSecond : 1)
+    , counts(new std::atomic<uint64>[CounterCount])
+{
+    reset();
+}
+
+
+void MIDI2Stats::reset()
+{
+    packets.store(0, std::memory_order_relaxed);
+    words.store(0, std::memory_order_relaxed);
+    corruptDataReports.store(0, std::memory_order_relaxed);
+    for (int i = 0; i < CounterCount; i++)
+    {
+        counts[i].store(0, std::memory_order_relaxed);
+    }
+    for (RateBucket& bucket : buckets)
+    {
+        bucket.second.store(~(uint64)0, std::memory_order_relaxed);
+        bucket.packets.store(0, std::memory_order_relaxed);
+        bucket.words.store(0, std::memory_order_relaxed);
+    }
+    currentSecond = 0;
+    currentBucket = &buckets[0];
+    currentBucket->second.store(0, std::memory_order_relaxed);
+}
+
+
+void MIDI2Stats::startSecond(uint64 second)
+{
+    // the bucket is reused after RateBucketCount seconds
+    currentBucket = &buckets[second % RateBucketCount];
+    currentBucket->packets.store(0, std::memory_order_relaxed);
+    currentBucket->words.store(0, std::memory_order_relaxed);
+    // publish the second last, so readers ignore the bucket while it is reset
+    currentBucket->second.store(second, std::memory_order_release);
+    currentSecond = second;
+}
+
+
+void MIDI2Stats::getSnapshot(Snapshot& snapshot, uint64 now) const
+{
+    snapshot.packets = packets.load(std::memory_order_relaxed);
+    snapshot.words = words.load(std::memory_order_relaxed);
+    snapshot.bytes = snapshot.words * 4;
+    snapshot.corruptDataReports = corruptDataReports.load(std::memory_order_relaxed);
+    for (int i = 0; i < CounterCount; i++)
+    {
+        snapshot.counts[i] = counts[i].load(std::memory_order_relaxed);
+    }
+
+    // rates: sum up the complete seconds before the current one
+    uint64 nowSecond = now / timestampUnitsPerSecond;
+    for (int w = 0; w < 3; w++)
+    {
+        uint64 packetSum = 0;
+        uint64 wordSum = 0;
+        int window = rateWindows[w];
+        for (int i = 1; i <= window && (uint64)i <= nowSecond; i++)
+        {
+            const RateBucket& bucket = buckets[(nowSecond - (uint64)i) % RateBucketCount];
+            if (bucket.second.load(std::memory_order_acquire) == nowSecond - (uint64)i)
+            {
+                packetSum += bucket.packets.load(std::memory_order_relaxed);
+                wordSum += bucket.words.load(std::memory_order_relaxed);
+            }
+        }
+        snapshot.packetRate[w] = (double)packetSum / window;
+        snapshot.wordRate[w] = (double)wordSum / window;
+    }
+}
+
+
+void MIDI2Stats::process(uint64 timestamp, const UMPacket& packet)
+{
+    count(timestamp, packet.getWord1(), packet.getSizeInWords());
+    if (downstream != nullptr)
+    {
+        downstream->process(timestamp, packet);
+    }
+}
+
+
+void MIDI2Stats::process(uint64 timestamp, UMPView packet)
+{
+    count(timestamp, packet.getWord1(), packet.getSizeInWords());
+    if (downstream != nullptr)
+    {
+        downstream->process(timestamp, packet);
+    }
+}
+
+
+void MIDI2Stats::processRawUMP(uint64 timestamp, const uint32* rawWords, int sizeInWords)
+{
+    passRawUMP(downstream, timestamp, rawWords, sizeInWords, [this](uint64 ts, UMPView packet)
+    {
+        count(ts, packet.getWord1(), packet.getSizeInWords());
+    });
+}
+
+
+void MIDI2Stats::processBlock(const UMPBlock& block)
+{
+    passBlock(downstream, block, [this](uint64 ts, UMPView packet)
+    {
+        count(ts, packet.getWord1(), packet.getSizeInWords());
+    });
+}
+
+
+void MIDI2Stats::onCorruptRawData(const char* errorMessage)
+{
+    add(corruptDataReports, 1);
+    if (downstream != nullptr)
+    {
+        downstream->onCorruptRawData(errorMessage);
+    }
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+
+#include "midi2.h"
+#include <atomic>
+#include <memory>
+
+
+/**
+ * Count the packets passing through, and pass them on unchanged.
+ *
+ * There is one counter for every combination of message type, group,
+ * status and channel (the upper 16 bits of word 1), plus totals, corrupt
+ * data reports, and per-second counts for rates over sliding windows.
+ *
+ * All counters are atomics written with relaxed stores. Only one thread
+ * may pass packets through a MIDI2Stats object, so no read-modify-write
+ * instructions are needed. Any other thread may call getSnapshot() at any
+ * time without blocking the writer; the snapshot is not taken atomically
+ * as a whole, but every single counter is consistent.
+ */
+class MIDI2Stats
+    : public MIDI2Processor
+{
+public:
+    static const int CounterCount = 65536;
+    /** number of one-second buckets kept for rates */
+    static const int RateBucketCount = 64;
+
+    /** about 512 KB, so better not put it on the stack */
+    struct Snapshot
+    {
+        uint64 packets;
+        uint64 words;
+        uint64 bytes;
+        uint64 corruptDataReports;
+        /** packets per second over the last 1, 10, and 60 seconds */
+        double packetRate[3];
+        double wordRate[3];
+        /** indexed by the upper 16 bits of word 1 */
+        uint64 counts[CounterCount];
+
+        uint64 getCount(int messageType, int group, int status, int channel) const
+        {
+            return counts[(messageType << 12) | (group << 8) | (status << 4) | channel];
+        }
+
+        /** @return the sum of all counters for this message type */
+        uint64 getMessageTypeCount(int messageType) const;
+        /** @return the sum of all counters for this group */
+        uint64 getGroupCount(int group) const;
+    };
+
+    /**
+     * @param downstream receives all packets, can be null
+     * @param timestampUnitsPerSecond the unit of the packet timestamps, used for rates
+     */
+    MIDI2Stats(MIDI2Processor* downstream = nullptr, uint64 timestampUnitsPerSecond = 1000000000);
+
+    /** set all counters to 0. Must not be called while packets pass through. */
+    void reset();
+
+    /**
+     * Copy all counters, can be called from any thread.
+     * @param now the current time in the unit of the packet timestamps,
+     *        e.g. MIDI2Clock::getHostTime(). The rates are calculated over
+     *        the complete seconds before now, so they drop to 0 when no
+     *        packets arrive. Packets with a timestamp older than the kept
+     *        seconds are counted, but not included in the rates.
+     */
+    void getSnapshot(Snapshot& snapshot, uint64 now) const;
+
+    void process(uint64 timestamp, const UMPacket& packet) override;
+    void process(uint64 timestamp, UMPView packet) override;
+    void processRawUMP(uint64 timestamp, const uint32* rawWords, int sizeInWords) override;
+    void processBlock(const UMPBlock& block) override;
+    void onCorruptRawData(const char* errorMessage) override;
+
+private:
+    struct RateBucket
+    {
+        std::atomic<uint64> second;
+        std::atomic<uint64> packets;
+        std::atomic<uint64> words;
+    };
+
+    /** single writer increment */
+    static void add(std::atomic<uint64>& counter, uint64 value)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    void count(uint64 timestamp, uint32 word1, int sizeInWords)
+    {
+        add(counts[word1 >> 16], 1);
+        add(packets, 1);
+        add(words, (uint64)sizeInWords);
+        uint64 second = timestamp / timestampUnitsPerSecond;
+        RateBucket* bucket = currentBucket;
+        if (second != currentSecond)
+        {
+            if (second > currentSecond)
+            {
+                startSecond(second);
+                bucket = currentBucket;
+            }
+            else
+            {
+                // an older second: count it only if its bucket was not reused yet
+                bucket = &buckets[second % RateBucketCount];
+                if (bucket->second.load(std::memory_order_relaxed) != second)
+                {
+                    return;
+                }
+            }
+        }
+        add(bucket->packets, 1);
+        add(bucket->words, (uint64)sizeInWords);
+    }
+
+    void startSecond(uint64 second);
+
+    MIDI2Processor* downstream;
+    uint64 timestampUnitsPerSecond;
+    uint64 currentSecond;
+    RateBucket* currentBucket;
+
+    std::atomic<uint64> packets;
+    std::atomic<uint64> words;
+    std::atomic<uint64> corruptDataReports;
+    std::unique_ptr<std::atomic<uint64>[]> counts;
+    RateBucket buckets[RateBucketCount];
+};
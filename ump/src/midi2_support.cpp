@@ -22,161 +22,335 @@
  * DEALINGS IN THE SOFTWARE.
  */
 #include "midi2_support.h"
-#include <time.h> // initializing rand()
+#include <time.h> // seeding the random number generators
 #include <stdlib.h>
+#include <atomic>
 
 #ifdef TARGET_WIN
 #define _CRT_SECURE_NO_WARNINGS
-#ifndef __wtypes_h__
-#include <wtypes.h>
-#endif
-#include <mmsystem.h>
-#pragma comment(lib, "winmm.lib")
+#include <windows.h>
 #endif
 
 #ifdef TARGET_APPLE
 #include <mach/mach_time.h>
-#include <sys/time.h>
 #endif
 
-#ifdef TARGET_WIN
-uint32 getMilliTime()
-{
-	static uint32 startTime = 0;
-	if (startTime == 0) {
-		startTime = timeGetTime();
-		// get millisecond time with millisecond resolution
-		timeBeginPeriod(1);
-	}
-	return timeGetTime() - startTime;
-}
+#if defined(TARGET_LINUX) && (defined(__x86_64__) || defined(__i386__))
+#define MIDI2_CLOCK_TSC
+#include <x86intrin.h>
+#include <cpuid.h>
+#endif
 
 
-#elif defined(TARGET_APPLE)
+//
+// MARK: MIDI2Clock
+//
 
-uint32 getMilliTime()
+static std::atomic<int> clockSource(MIDI2Clock::SourceSystem);
+static std::atomic<uint64> manualNanos(0);
+
+#if defined(TARGET_APPLE)
+
+struct HostTimebase
 {
-	static uint64 startTick = 0;
-	static double factor = 0.0;
-	if (startTick == 0)
-	{
-		mach_timebase_info_data_t tinfo;
-		kern_return_t kerror = mach_timebase_info(&tinfo);
-		if (kerror == KERN_SUCCESS)
-		{
-			startTick = mach_absolute_time();
-			// tick to millis
-			factor = ((double)tinfo.numer / tinfo.denom) / 1000000.0;
-			return 0;
-		}
-	}
-	else
-	{
-		return (uint32)((mach_absolute_time() - startTick) * factor);
-	}
-    // fallback
-    struct timeval t;
-    gettimeofday(&t, 0);
-    static time_t startSeconds = t.tv_sec;
-    return (uint32)(((t.tv_sec - startSeconds) * 1000) + (t.tv_usec / 1000));
-}
-
-
-#elif defined(TARGET_LINUX)
+    HostTimebase()
+    {
+        mach_timebase_info_data_t info;
+        if (mach_timebase_info(&info) != KERN_SUCCESS || info.numer == 0 || info.denom == 0)
+        {
+            info.numer = 1;
+            info.denom = 1;
+        }
+        numer = info.numer;
+        denom = info.denom;
+    }
+    uint32 numer;
+    uint32 denom;
+};
 
-uint32 getMilliTime()
+static const HostTimebase& getHostTimebase()
 {
-	static BBool supportsMonotonicClock = TRUE;
-	if (supportsMonotonicClock)
-	{
-		struct timespec ts;
-		if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
-		{
-			static time_t tsStartSeconds = ts.tv_sec;
-			return (uint32)(((ts.tv_sec - tsStartSeconds) * 1000) + (ts.tv_nsec / 1000000));
-		}
-		else
-		{
-			supportsMonotonicClock = FALSE;
-		}
-	}
-
-	// fallback
-	struct timeval t;
-	gettimeofday(&t, 0);
-	static time_t startSeconds = t.tv_sec;
-	return (uint32)(((t.tv_sec - startSeconds) * 1000) + (t.tv_usec / 1000));
+    static const HostTimebase timebase;
+    return timebase;
 }
-#endif
 
+static uint64 getSystemHostTime()
+{
+    return mach_absolute_time();
+}
 
-int brandom()
+uint64 MIDI2Clock::hostTimeToNanos(uint64 hostTime)
 {
-    static bool inited = FALSE;
-    if (!inited) {
-        srand((int)time(NULL));
-        inited = true;
+    const HostTimebase& timebase = getHostTimebase();
+    if (timebase.numer == timebase.denom)
+    {
+        return hostTime;
     }
-    return rand();
+    return (uint64)((unsigned __int128)hostTime * timebase.numer / timebase.denom);
 }
 
-int brandom_max()
+uint64 MIDI2Clock::nanosToHostTime(uint64 nanos)
 {
-    return RAND_MAX;
+    const HostTimebase& timebase = getHostTimebase();
+    if (timebase.numer == timebase.denom)
+    {
+        return nanos;
+    }
+    return (uint64)((unsigned __int128)nanos * timebase.denom / timebase.numer);
 }
 
-int brandom(int min, int max)
+#elif defined(TARGET_WIN)
+
+static uint64 getSystemHostTime()
 {
-    if (min >= max)
+    static const uint64 frequency = []()
     {
-        return min;
-    }
-    uint32 range = (max - min);
+        LARGE_INTEGER f;
+        QueryPerformanceFrequency(&f);
+        return (uint64)f.QuadPart;
+    }();
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    uint64 c = (uint64)counter.QuadPart;
+    // split, to not overflow
+    return (c / frequency) * 1000000000ULL + (c % frequency) * 1000000000ULL / frequency;
+}
+
+uint64 MIDI2Clock::hostTimeToNanos(uint64 hostTime)
+{
+    return hostTime;
+}
+
+uint64 MIDI2Clock::nanosToHostTime(uint64 nanos)
+{
+    return nanos;
+}
 
-    uint32 rnd;
-    if (range > RAND_MAX)
+#else
+
+static uint64 getSystemHostTime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64)ts.tv_sec * 1000000000ULL + (uint64)ts.tv_nsec;
+}
+
+uint64 MIDI2Clock::hostTimeToNanos(uint64 hostTime)
+{
+    return hostTime;
+}
+
+uint64 MIDI2Clock::nanosToHostTime(uint64 nanos)
+{
+    return nanos;
+}
+
+#endif
+
+
+#ifdef MIDI2_CLOCK_TSC
+
+/** maps the TSC to system clock nanoseconds, measured once */
+struct TSCCalibration
+{
+    TSCCalibration()
+        : valid(false), baseTicks(0), baseNanos(0), nanosPerTick(0)
     {
-        if (range > 0xFFFF)
+        // the TSC must run at a constant rate in all power states
+        unsigned int eax, ebx, ecx, edx;
+        if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) == 0 || (edx & (1 << 8)) == 0)
         {
-            rnd = brandom32();
+            return;
         }
-        else
+        uint64 startTicks, startNanos, endTicks, endNanos;
+        sample(startTicks, startNanos);
+        struct timespec duration = { 0, 20000000 };
+        nanosleep(&duration, nullptr);
+        sample(endTicks, endNanos);
+        if (endTicks <= startTicks || endNanos <= startNanos)
         {
-            rnd = brandom16();
+            return;
         }
+        nanosPerTick = (uint64)(((unsigned __int128)(endNanos - startNanos) << 32) / (endTicks - startTicks));
+        baseTicks = endTicks;
+        baseNanos = endNanos;
+        valid = true;
     }
-    else
+
+    /** read the system clock between two TSC reads, and use the TSC in the middle */
+    static void sample(uint64& ticks, uint64& nanos)
     {
-        rnd = (uint32)brandom();
+        uint64 before = __rdtsc();
+        nanos = getSystemHostTime();
+        uint64 after = __rdtsc();
+        ticks = before + (after - before) / 2;
     }
-    return ((int)(rnd % (range + 1))) + min;
+
+    uint64 now() const
+    {
+        uint64 ticks = __rdtsc() - baseTicks;
+        return baseNanos + (uint64)(((unsigned __int128)ticks * nanosPerTick) >> 32);
+    }
+
+    bool valid;
+    uint64 baseTicks;
+    uint64 baseNanos;
+    // 32.32 fixed point
+    uint64 nanosPerTick;
+};
+
+static const TSCCalibration& getTSCCalibration()
+{
+    static const TSCCalibration calibration;
+    return calibration;
 }
 
+#endif
 
-uint8 brandom8()
+
+uint64 MIDI2Clock::now()
 {
-    return (uint8)(brandom() & 0xFF);
+    switch (clockSource.load(std::memory_order_relaxed))
+    {
+        case SourceManual:
+            return manualNanos.load(std::memory_order_relaxed);
+#ifdef MIDI2_CLOCK_TSC
+        case SourceTSC:
+            return getTSCCalibration().now();
+#endif
+        default:
+            return hostTimeToNanos(getSystemHostTime());
+    }
 }
 
 
-uint16 brandom16()
+uint64 MIDI2Clock::getHostTime()
+{
+    if (clockSource.load(std::memory_order_relaxed) == SourceSystem)
+    {
+        return getSystemHostTime();
+    }
+    return nanosToHostTime(now());
+}
+
+
+bool MIDI2Clock::setSource(Source source)
 {
-#if RAND_MAX < 0xFFFF
-    return (uint16)(((brandom() & 0xFF) << 8) | (brandom() & 0xFF));
+    switch (source)
+    {
+        case SourceSystem:
+        case SourceManual:
+            break;
+        case SourceTSC:
+#ifdef MIDI2_CLOCK_TSC
+            if (!getTSCCalibration().valid)
+            {
+                return false;
+            }
+            break;
 #else
-    return (uint16)(brandom() & 0xFFFF);
+            return false;
 #endif
+        default:
+            return false;
+    }
+    clockSource.store(source, std::memory_order_relaxed);
+    return true;
+}
+
+
+MIDI2Clock::Source MIDI2Clock::getSource()
+{
+    return (Source)clockSource.load(std::memory_order_relaxed);
+}
+
+
+void MIDI2Clock::setManualTime(uint64 nanos)
+{
+    manualNanos.store(nanos, std::memory_order_relaxed);
+}
+
+
+void MIDI2Clock::advanceManualTime(uint64 nanos)
+{
+    manualNanos.fetch_add(nanos, std::memory_order_relaxed);
+}
+
+
+uint32 getMilliTime()
+{
+    return (uint32)(MIDI2Clock::now() / 1000000);
+}
+
+
+//
+// MARK: random numbers
+//
+
+void MIDI2Random::setSeed(uint64 seed)
+{
+    // splitmix64, so that similar seeds give unrelated sequences
+    for (int i = 0; i < 4; i++)
+    {
+        seed += 0x9E3779B97F4A7C15ULL;
+        uint64 z = seed;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        state[i] = z ^ (z >> 31);
+    }
+}
+
+
+static thread_local bool threadRandomSeeded = false;
+
+MIDI2Random& getThreadRandom()
+{
+    static thread_local MIDI2Random random;
+    if (!threadRandomSeeded)
+    {
+        // different threads started at the same time must differ
+        static std::atomic<uint64> threadCount(0);
+        random.setSeed((uint64)time(NULL) ^ (threadCount.fetch_add(1) << 32));
+        threadRandomSeeded = true;
+    }
+    return random;
+}
+
+
+void setThreadRandomSeed(uint64 seed)
+{
+    getThreadRandom().setSeed(seed);
+}
+
+
+int brandom()
+{
+    return (int)(getThreadRandom().next32() & RAND_MAX);
+}
+
+int brandom_max()
+{
+    return RAND_MAX;
+}
+
+int brandom(int min, int max)
+{
+    return getThreadRandom().next(min, max);
+}
+
+
+uint8 brandom8()
+{
+    return (uint8)getThreadRandom().next32();
+}
+
+
+uint16 brandom16()
+{
+    return (uint16)getThreadRandom().next32();
 }
 
 uint32 brandom32()
 {
-#if RAND_MAX == 0xFFFFFFFF
-    return (uint32)brandom();
-#elif RAND_MAX >= 0xFFFF
-    return (uint32)((brandom() & 0xFFFF) << 16) | (brandom() & 0xFFFF);
-#elif RAND_MAX >= 0x7FF
-    return (uint32)(((brandom() & 0x7FF) << 22) | ((brandom() & 0x7FF) << 11) | (brandom() & 0x7FF));
-#else
-    return (uint32)(((brandom() & 0xFF) << 24) | ((brandom() & 0xFF) << 16) | ((brandom() & 0xFF) << 8) | (brandom() & 0xFF));
-#endif
+    return getThreadRandom().next32();
 }
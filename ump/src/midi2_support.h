@@ -59,6 +59,34 @@ typedef long long          int64;
 typedef unsigned long long uint64;
 #endif
 
+#ifdef TARGET_WIN
+#include <intrin.h>
+#endif
+
+/** @return the index of the lowest set bit; value must not be 0 */
+inline int getLowestBitIndex(uint32 value)
+{
+#ifdef TARGET_WIN
+    unsigned long index;
+    _BitScanForward(&index, value);
+    return (int)index;
+#else
+    return __builtin_ctz(value);
+#endif
+}
+
+/** @return the index of the highest set bit; value must not be 0 */
+inline int getHighestBitIndex64(uint64 value)
+{
+#ifdef TARGET_WIN
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return (int)index;
+#else
+    return 63 - __builtin_clzll(value);
+#endif
+}
+
 #ifndef TRUE
 #define TRUE true
 #endif
@@ -132,10 +160,112 @@ typedef unsigned long long uint64;
 
 //
 
+/**
+ * Monotonic clock with 64-bit nanoseconds. It uses the time base of the
+ * UMP packet timestamps (the host time), so packet timestamps converted
+ * with hostTimeToNanos() can be compared with now(). All functions are
+ * thread-safe.
+ *
+ * The default source is the system clock: mach_absolute_time() on Apple,
+ * and clock_gettime(CLOCK_MONOTONIC) elsewhere, which Linux serves from
+ * the vDSO without a system call. On x86 Linux with an invariant TSC, the
+ * CPU time stamp counter can be used instead, calibrated once against the
+ * system clock. For tests and offline rendering, use the manual source and
+ * set the time explicitly.
+ */
+class MIDI2Clock
+{
+public:
+    typedef enum
+    {
+        SourceSystem,
+        SourceTSC,
+        SourceManual
+    }
+    Source;
+
+    /** @return the current time in nanoseconds */
+    static uint64 now();
+
+    /** @return the current time in the unit of packet timestamps */
+    static uint64 getHostTime();
+
+    static uint64 hostTimeToNanos(uint64 hostTime);
+    static uint64 nanosToHostTime(uint64 nanos);
+
+    /**
+     * Select the clock source. Selecting SourceTSC calibrates the TSC
+     * first, which takes about 20ms.
+     * @return false if the source is not available on this machine
+     */
+    static bool setSource(Source source);
+    static Source getSource();
+
+    /** set the time of the manual source, in nanoseconds */
+    static void setManualTime(uint64 nanos);
+    static void advanceManualTime(uint64 nanos);
+};
+
+/** @deprecated use MIDI2Clock::now(): this wraps after 49 days */
 uint32 getMilliTime();
 
 // random numbers
 
+/**
+ * xoshiro256** pseudo random number generator: fast, and the same seed
+ * always gives the same sequence. An instance must only be used by one
+ * thread; use getThreadRandom() for a generator per thread.
+ */
+class MIDI2Random
+{
+public:
+    MIDI2Random(uint64 seed = 0) { setSeed(seed); }
+
+    /** restart the sequence; the seed is expanded with splitmix64 */
+    void setSeed(uint64 seed);
+
+    uint64 next64()
+    {
+        uint64 result = rotl(state[1] * 5, 7) * 9;
+        uint64 t = state[1] << 17;
+        state[2] ^= state[0];
+        state[3] ^= state[1];
+        state[1] ^= state[2];
+        state[0] ^= state[3];
+        state[2] ^= t;
+        state[3] = rotl(state[3], 45);
+        return result;
+    }
+
+    uint32 next32() { return (uint32)(next64() >> 32); }
+
+    /** @return a number 0..range-1, without division */
+    uint32 next(uint32 range) { return (uint32)(((uint64)next32() * range) >> 32); }
+
+    /** @return a number min..max, inclusive */
+    int next(int min, int max)
+    {
+        if (min >= max) return min;
+        uint32 range = (uint32)max - (uint32)min + 1;
+        return (int)((uint32)min + (range == 0 ? next32() : next(range)));
+    }
+
+private:
+    static uint64 rotl(uint64 x, int k) { return (x << k) | (x >> (64 - k)); }
+
+    uint64 state[4];
+};
+
+/**
+ * The random number generator of the calling thread, used by the brandom()
+ * functions. Unless setThreadRandomSeed() was called, it is seeded from the
+ * time and the thread.
+ */
+MIDI2Random& getThreadRandom();
+
+/** seed the generator of the calling thread, for reproducible sequences */
+void setThreadRandomSeed(uint64 seed);
+
 int brandom();
 int brandom_max();
 int brandom(int min, int max);
@@ -0,0 +1,335 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "midi2_sysex.h"
+
+#include <stddef.h>
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#define SYSEX_ENCODER_SSSE3
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define SYSEX_ENCODER_NEON
+#endif
+
+
+//
+// MARK: MIDI2SysEx7Assembler
+//
+
+MIDI2SysEx7Assembler::MIDI2SysEx7Assembler(Listener* _listener, int _maxMessageSize /* = 4096 */, int bufferCount /* = 4 */)
+    : MIDI2Processor()
+    , listener(_listener)
+    , maxMessageSize(_maxMessageSize > 0 ? _maxMessageSize : 1)
+    , droppedNoBuffer(0)
+    , droppedTooLong(0)
+    , droppedIncomplete(0)
+{
+    if (bufferCount < 0)
+    {
+        bufferCount = 0;
+    }
+    pool.resize((size_t)maxMessageSize * bufferCount);
+    freeBuffers.reserve(bufferCount);
+    for (int i = bufferCount - 1; i >= 0; i--)
+    {
+        freeBuffers.push_back(i);
+    }
+}
+
+
+void MIDI2SysEx7Assembler::setListener(Listener* _listener)
+{
+    listener = _listener;
+}
+
+
+void MIDI2SysEx7Assembler::reset()
+{
+    for (Slot& slot : slots)
+    {
+        releaseBuffer(slot);
+        slot.dropping = false;
+    }
+}
+
+
+void MIDI2SysEx7Assembler::releaseBuffer(Slot& slot)
+{
+    if (slot.buffer >= 0)
+    {
+        freeBuffers.push_back(slot.buffer);
+        slot.buffer = -1;
+    }
+    slot.length = 0;
+}
+
+
+bool MIDI2SysEx7Assembler::append(Slot& slot, const UMPView& packet)
+{
+    int count = packet.getSysEx7ByteCount();
+    if (count > UMPacket::SysEx7MaxBytesPerPacket)
+    {
+        count = UMPacket::SysEx7MaxBytesPerPacket;
+    }
+    if (slot.length + count > maxMessageSize)
+    {
+        return false;
+    }
+    byte* dest = &pool[(size_t)slot.buffer * maxMessageSize + slot.length];
+    for (int i = 0; i < count; i++)
+    {
+        dest[i] = packet.getSysEx7Byte(i);
+    }
+    slot.length += count;
+    return true;
+}
+
+
+void MIDI2SysEx7Assembler::process(uint64 timestamp, const UMPacket& packet)
+{
+    process(timestamp, UMPView(packet));
+}
+
+
+void MIDI2SysEx7Assembler::process(uint64 timestamp, UMPView packet)
+{
+    if (packet.getMessageType() != UMPacket::Data64)
+    {
+        return;
+    }
+    uint4 group = packet.getGroup();
+    Slot& slot = slots[group];
+
+    switch (packet.getSysEx7Status())
+    {
+        case UMPacket::SysEx7StatusComplete:
+        {
+            // a message which is already being dropped was counted when it was dropped
+            if (slot.buffer >= 0)
+            {
+                // previous message was not ended
+                droppedIncomplete++;
+                releaseBuffer(slot);
+            }
+            slot.dropping = false;
+            // no need for a pool buffer
+            byte data[UMPacket::SysEx7MaxBytesPerPacket];
+            int count = packet.getSysEx7ByteCount();
+            if (count > UMPacket::SysEx7MaxBytesPerPacket)
+            {
+                count = UMPacket::SysEx7MaxBytesPerPacket;
+            }
+            for (int i = 0; i < count; i++)
+            {
+                data[i] = packet.getSysEx7Byte(i);
+            }
+            if (listener != nullptr)
+            {
+                listener->sysExReceived(timestamp, group, data, count);
+            }
+            break;
+        }
+        case UMPacket::SysEx7StatusStart:
+        {
+            if (slot.buffer >= 0)
+            {
+                droppedIncomplete++;
+                releaseBuffer(slot);
+            }
+            slot.dropping = false;
+            if (freeBuffers.empty())
+            {
+                droppedNoBuffer++;
+                slot.dropping = true;
+                break;
+            }
+            slot.buffer = freeBuffers.back();
+            freeBuffers.pop_back();
+            if (!append(slot, packet))
+            {
+                droppedTooLong++;
+                releaseBuffer(slot);
+                slot.dropping = true;
+            }
+            break;
+        }
+        case UMPacket::SysEx7StatusContinue: // fall through
+        case UMPacket::SysEx7StatusEnd:
+        {
+            bool isEnd = (packet.getSysEx7Status() == UMPacket::SysEx7StatusEnd);
+            if (slot.dropping)
+            {
+                if (isEnd)
+                {
+                    slot.dropping = false;
+                }
+                break;
+            }
+            if (slot.buffer < 0)
+            {
+                // no start packet: drop until the end
+                droppedIncomplete++;
+                slot.dropping = !isEnd;
+                break;
+            }
+            if (!append(slot, packet))
+            {
+                droppedTooLong++;
+                releaseBuffer(slot);
+                slot.dropping = !isEnd;
+                break;
+            }
+            if (isEnd)
+            {
+                if (listener != nullptr)
+                {
+                    listener->sysExReceived(timestamp, group,
+                                            &pool[(size_t)slot.buffer * maxMessageSize], slot.length);
+                }
+                releaseBuffer(slot);
+            }
+            break;
+        }
+        default:
+            // reserved status
+            break;
+    }
+}
+
+
+//
+// MARK: MIDI2SysEx7Encoder
+//
+
+int MIDI2SysEx7Encoder::getPacketCount(int length)
+{
+    if (length <= UMPacket::SysEx7MaxBytesPerPacket)
+    {
+        return 1;
+    }
+    return (length + UMPacket::SysEx7MaxBytesPerPacket - 1) / UMPacket::SysEx7MaxBytesPerPacket;
+}
+
+
+/** write one Data64 packet with up to 6 bytes */
+static inline void writeSysEx7Packet(uint32* out, uint4 group, UMPacket::SysEx7Status status, const byte* data, int count)
+{
+    byte b[UMPacket::SysEx7MaxBytesPerPacket] = { 0, 0, 0, 0, 0, 0 };
+    for (int i = 0; i < count; i++)
+    {
+        b[i] = data[i] & 0x7F;
+    }
+    out[0] = (((uint32)UMPacket::Data64) << 28)
+        | (((uint32)group & 0x0F) << 24)
+        | (((uint32)status & 0x0F) << 20)
+        | (((uint32)count) << 16)
+        | (((uint32)b[0]) << 8)
+        | ((uint32)b[1]);
+    out[1] = (((uint32)b[2]) << 24) | (((uint32)b[3]) << 16) | (((uint32)b[4]) << 8) | (uint32)b[5];
+}
+
+
+/**
+ * write continue packets with 6 bytes each.
+ * @return the number of packets written
+ */
+static int writeSysEx7ContinuePackets(uint32* out, uint4 group, const byte* data, int packetCount, const byte* dataEnd)
+{
+    int done = 0;
+#if defined(SYSEX_ENCODER_SSSE3) || defined(SYSEX_ENCODER_NEON)
+    // 2 packets (12 bytes in, 16 bytes out) per step. In memory, a little endian packet is:
+    // b1 b0 [status|count] [type|group] b5 b4 b3 b2
+    const byte header2 = (byte)((UMPacket::SysEx7StatusContinue << 4) | UMPacket::SysEx7MaxBytesPerPacket);
+    const byte header3 = (byte)((UMPacket::Data64 << 4) | (group & 0x0F));
+#if defined(SYSEX_ENCODER_SSSE3)
+    const __m128i shuffle = _mm_setr_epi8(1, 0, -1, -1, 5, 4, 3, 2, 7, 6, -1, -1, 11, 10, 9, 8);
+    const __m128i dataMask = _mm_setr_epi8(0x7F, 0x7F, 0, 0, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0, 0, 0x7F, 0x7F, 0x7F, 0x7F);
+    const __m128i header = _mm_setr_epi8(0, 0, (char)header2, (char)header3, 0, 0, 0, 0, 0, 0, (char)header2, (char)header3, 0, 0, 0, 0);
+    // each step loads 16 bytes, but only uses 12
+    while (done + 2 <= packetCount && data + 16 <= dataEnd)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i*)data);
+        __m128i v = _mm_or_si128(_mm_and_si128(_mm_shuffle_epi8(in, shuffle), dataMask), header);
+        _mm_storeu_si128((__m128i*)out, v);
+        data += 2 * UMPacket::SysEx7MaxBytesPerPacket;
+        out += 4;
+        done += 2;
+    }
+#else
+    static const byte shuffleBytes[16] = { 1, 0, 0xFF, 0xFF, 5, 4, 3, 2, 7, 6, 0xFF, 0xFF, 11, 10, 9, 8 };
+    static const byte maskBytes[16] = { 0x7F, 0x7F, 0, 0, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0, 0, 0x7F, 0x7F, 0x7F, 0x7F };
+    const byte headerBytes[16] = { 0, 0, header2, header3, 0, 0, 0, 0, 0, 0, header2, header3, 0, 0, 0, 0 };
+    const uint8x16_t shuffle = vld1q_u8(shuffleBytes);
+    const uint8x16_t dataMask = vld1q_u8(maskBytes);
+    const uint8x16_t header = vld1q_u8(headerBytes);
+    while (done + 2 <= packetCount && data + 16 <= dataEnd)
+    {
+        uint8x16_t in = vld1q_u8(data);
+        uint8x16_t v = vorrq_u8(vandq_u8(vqtbl1q_u8(in, shuffle), dataMask), header);
+        vst1q_u8((uint8_t*)out, v);
+        data += 2 * UMPacket::SysEx7MaxBytesPerPacket;
+        out += 4;
+        done += 2;
+    }
+#endif
+#else
+    // only needed for the 16 byte loads
+    (void)dataEnd;
+#endif
+    for (; done < packetCount; done++)
+    {
+        writeSysEx7Packet(out, group, UMPacket::SysEx7StatusContinue, data, UMPacket::SysEx7MaxBytesPerPacket);
+        data += UMPacket::SysEx7MaxBytesPerPacket;
+        out += 2;
+    }
+    return done;
+}
+
+
+int MIDI2SysEx7Encoder::encode(uint4 group, const byte* data, int length, uint32* outWords, int maxWords)
+{
+    if (length < 0 || (length > 0 && data == nullptr))
+    {
+        return -1;
+    }
+    int packetCount = getPacketCount(length);
+    if (outWords == nullptr || maxWords < packetCount * 2)
+    {
+        return -1;
+    }
+    const int bytesPerPacket = UMPacket::SysEx7MaxBytesPerPacket;
+    if (packetCount == 1)
+    {
+        writeSysEx7Packet(outWords, group, UMPacket::SysEx7StatusComplete, data, length);
+        return 2;
+    }
+
+    writeSysEx7Packet(outWords, group, UMPacket::SysEx7StatusStart, data, bytesPerPacket);
+    writeSysEx7ContinuePackets(outWords + 2, group, data + bytesPerPacket, packetCount - 2, data + length);
+    int lastOffset = (packetCount - 1) * bytesPerPacket;
+    writeSysEx7Packet(outWords + (packetCount - 1) * 2, group, UMPacket::SysEx7StatusEnd,
+                      data + lastOffset, length - lastOffset);
+    return packetCount * 2;
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+
+#include "midi2.h"
+#include <vector>
+
+
+/**
+ * Reassemble System Exclusive messages from Data64 (SysEx7) packets.
+ *
+ * There is one assembly slot per group. Buffers are taken from a pool
+ * which is allocated once in the constructor, so no memory is allocated
+ * while receiving. If no buffer is available, or a message is longer than
+ * the maximum message size, the message is dropped and counted.
+ * Complete messages are passed to the listener without F0 and F7.
+ *
+ * Not thread safe: call process() from one thread only.
+ */
+class MIDI2SysEx7Assembler
+    : public MIDI2Processor
+{
+public:
+    class Listener
+    {
+    public:
+        virtual ~Listener() {}
+        /**
+         * A complete SysEx message was received.
+         * data is only valid during this call.
+         * @param timestamp the timestamp of the last packet of the message
+         */
+        virtual void sysExReceived(uint64 timestamp, uint4 group, const byte* data, int length) = 0;
+    };
+
+    /**
+     * @param maxMessageSize the maximum SysEx length in bytes
+     * @param bufferCount the number of messages which can be assembled at the same time
+     */
+    MIDI2SysEx7Assembler(Listener* listener, int maxMessageSize = 4096, int bufferCount = 4);
+
+    void setListener(Listener* listener);
+
+    /** all packets other than Data64 are ignored */
+    void process(uint64 timestamp, const UMPacket& packet) override;
+    void process(uint64 timestamp, UMPView packet) override;
+
+    /** abort all messages currently being assembled */
+    void reset();
+
+    /** number of messages dropped because no buffer was available */
+    uint32 getDroppedNoBufferCount() const { return droppedNoBuffer; }
+    /** number of messages dropped because they were longer than maxMessageSize */
+    uint32 getDroppedTooLongCount() const { return droppedTooLong; }
+    /** number of messages dropped because of a missing start or end packet */
+    uint32 getDroppedIncompleteCount() const { return droppedIncomplete; }
+
+private:
+    struct Slot
+    {
+        /** index of the pool buffer, or -1 */
+        int buffer = -1;
+        int length = 0;
+        /** the current message is being dropped: ignore until the end packet */
+        bool dropping = false;
+    };
+
+    /** append the bytes of the packet, @return false if the message is too long */
+    bool append(Slot& slot, const UMPView& packet);
+    void releaseBuffer(Slot& slot);
+
+    Listener* listener;
+    int maxMessageSize;
+    std::vector<byte> pool;
+    std::vector<int> freeBuffers;
+    Slot slots[16];
+    uint32 droppedNoBuffer;
+    uint32 droppedTooLong;
+    uint32 droppedIncomplete;
+};
+
+
+/**
+ * Convert a System Exclusive message to Data64 (SysEx7) packets.
+ *
+ * The packets are written directly as words to the caller's buffer:
+ * 6 bytes per packet, with start/continue/end or complete status.
+ * The continue packets are converted with SIMD byte shuffles
+ * (SSSE3 or NEON) where available.
+ */
+class MIDI2SysEx7Encoder
+{
+public:
+    /** @return the number of packets needed for length SysEx bytes */
+    static int getPacketCount(int length);
+
+    /** @return the number of words needed for length SysEx bytes */
+    static int getSizeInWords(int length) { return getPacketCount(length) * 2; }
+
+    /**
+     * Convert the SysEx message to Data64 packets.
+     * @param data the SysEx data bytes, without F0 and F7
+     * @param outWords receives the packets
+     * @param maxWords the size of outWords, must be at least getSizeInWords(length)
+     * @return the number of words written, or -1 if outWords is too small
+     */
+    static int encode(uint4 group, const byte* data, int length, uint32* outWords, int maxWords);
+};
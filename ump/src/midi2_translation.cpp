@@ -35,7 +35,9 @@
 // ---------------------------------
 // Translation
 // ---------------------------------
-#define TRANSLATION_BANKCHANGE_TIME_THRESHOLD_MILLIS  (500)
+#define TRANSLATION_BANKCHANGE_TIME_THRESHOLD_NANOS  (500000000ULL)
+// bank change time if no bank change was received (0 is a valid time with a manual clock)
+#define TRANSLATION_BANKCHANGE_TIME_NONE  (~(uint64)0)
 
 
 //
@@ -60,8 +62,8 @@ void MIDI2Translator::init()
 	listener = NULL;
 	translateToMIDI2Group = 0;
 	translateFromMIDI2Group = -1;
-	bankChangeLSBtime = 0;
-	bankChangeMSBtime = 0;
+	bankChangeLSBtime = TRANSLATION_BANKCHANGE_TIME_NONE;
+	bankChangeMSBtime = TRANSLATION_BANKCHANGE_TIME_NONE;
 	memset(runtimeFlags, 0, sizeof(runtimeFlags));
 	memset(paramNRPN_MSB, 0, sizeof(paramNRPN_MSB));
 	memset(paramNRPN_LSB, 0, sizeof(paramNRPN_LSB));
@@ -110,14 +112,14 @@ bool MIDI2Translator::midi1ControlChangeReceived(uint4 channel, uint7 index, uin
 	{
 		// remember bank changes
 		bankChangeMSB = (byte)value;
-		bankChangeMSBtime = getMilliTime();
+		bankChangeMSBtime = MIDI2Clock::now();
 		break;
 	}
 	case MIDI_CC_BANKSELECT_LSB:
 	{
 		// remember bank changes
 		bankChangeLSB = (byte)value;
-		bankChangeLSBtime = getMilliTime();
+		bankChangeLSBtime = MIDI2Clock::now();
 		break;
 	}
 	case MIDI_CC_DATA_MSB:
@@ -262,22 +264,22 @@ bool MIDI2Translator::midi1Received(const byte* data, int len)
 		{
 			// Program Change
 			// update bank info
-			uint32 currTime = getMilliTime();
+			uint64 currTime = MIDI2Clock::now();
 			uint32 bankLSB = 0;
 			uint32 bankMSB = 0;
 			uint8 options = 0;
-			if (bankChangeMSBtime != 0 && ((currTime - bankChangeMSBtime) < TRANSLATION_BANKCHANGE_TIME_THRESHOLD_MILLIS))
+			if (bankChangeMSBtime != TRANSLATION_BANKCHANGE_TIME_NONE && ((currTime - bankChangeMSBtime) < TRANSLATION_BANKCHANGE_TIME_THRESHOLD_NANOS))
 			{
 				bankMSB = (int)bankChangeMSB;
 				options |= UMPacket::BankSelectValidFlag;
 			}
-			if (bankChangeLSBtime != 0 && ((currTime - bankChangeLSBtime) < TRANSLATION_BANKCHANGE_TIME_THRESHOLD_MILLIS))
+			if (bankChangeLSBtime != TRANSLATION_BANKCHANGE_TIME_NONE && ((currTime - bankChangeLSBtime) < TRANSLATION_BANKCHANGE_TIME_THRESHOLD_NANOS))
 			{
 				bankLSB = (int)bankChangeLSB;
 				options |= UMPacket::BankSelectValidFlag;
 			}
-			bankChangeMSBtime = 0;
-			bankChangeLSBtime = 0;
+			bankChangeMSBtime = TRANSLATION_BANKCHANGE_TIME_NONE;
+			bankChangeLSBtime = TRANSLATION_BANKCHANGE_TIME_NONE;
 
 			listener->translatedMessage(packet.initProgramChange(translateToMIDI2Group, channel, options, data1, bankLSB, bankMSB));
 			return TRUE;
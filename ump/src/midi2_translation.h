@@ -97,7 +97,7 @@ private:
 	int translateToMIDI2Group;
 	int translateFromMIDI2Group;
 	byte bankChangeLSB, bankChangeMSB;
-	uint32 bankChangeLSBtime, bankChangeMSBtime;
+	uint64 bankChangeLSBtime, bankChangeMSBtime; // MIDI2Clock nanoseconds
 	
 	enum RuntimeFlags {
 		// runtime flags
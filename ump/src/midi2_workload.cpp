@@ -0,0 +1,323 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "midi2_workload.h"
+#include <chrono>
+#include <thread>
+#include <string.h>
+
+
+MIDI2WorkloadGenerator::MIDI2WorkloadGenerator(MIDI2Processor& _target, uint64 _seed)
+    : target(_target)
+    , seed(_seed)
+    , random(_seed)
+    , profile(ProfileNotes)
+    , groupCount(1)
+    , packetsPerSecond(0)
+    , timestampUnitsPerSecond(1000000000)
+{
+    groups[0] = 0;
+    reset();
+}
+
+
+int MIDI2WorkloadGenerator::profileFromString(const char* name)
+{
+    for (int i = 0; i < ProfileCount; i++)
+    {
+        if (strcmp(name, profileNames[i]) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+void MIDI2WorkloadGenerator::setGroups(uint16 groupMask)
+{
+    groupCount = 0;
+    for (int g = 0; g < 16; g++)
+    {
+        if (groupMask & (1 << g))
+        {
+            groups[groupCount++] = (byte)g;
+        }
+    }
+    if (groupCount == 0)
+    {
+        groups[groupCount++] = 0;
+    }
+}
+
+
+void MIDI2WorkloadGenerator::setRate(double _packetsPerSecond, uint64 _timestampUnitsPerSecond)
+{
+    packetsPerSecond = (_packetsPerSecond > 0) ? _packetsPerSecond : 0;
+    timestampUnitsPerSecond = _timestampUnitsPerSecond;
+}
+
+
+void MIDI2WorkloadGenerator::reset()
+{
+    random.setSeed(seed);
+    packetCount = 0;
+    heldNoteCount = 0;
+    memset(mpeNotes, 0xFF, sizeof(mpeNotes));
+    sysExBytesLeft = 0;
+    sysExStarted = false;
+    sysExGroup = 0;
+}
+
+
+uint4 MIDI2WorkloadGenerator::nextGroup()
+{
+    return (groupCount == 1) ? groups[0] : groups[random.next((uint32)groupCount)];
+}
+
+
+UMPacket MIDI2WorkloadGenerator::nextPacket()
+{
+    uint4 group = nextGroup();
+    Profile p = profile;
+    if (p == ProfileMixed)
+    {
+        p = (Profile)random.next(ProfileMixed);
+    }
+    switch (p)
+    {
+        case ProfilePerNoteControllers: return nextPerNoteControllerPacket(group);
+        case ProfileMPEPitchBend: return nextMPEPacket(group);
+        case ProfileSysExBursts: return nextSysExPacket(group);
+        default: return nextNotePacket(group);
+    }
+}
+
+
+//
+// MARK: profiles
+//
+
+UMPacket MIDI2WorkloadGenerator::nextNotePacket(uint4 group)
+{
+    if (heldNoteCount > 0 && (heldNoteCount == MaxHeldNotes || random.next(2) == 0))
+    {
+        // the note off goes to the group of the note on
+        int index = (int)random.next((uint32)heldNoteCount);
+        uint16 heldNote = heldNotes[index];
+        heldNotes[index] = heldNotes[--heldNoteCount];
+        return UMPacket().initNoteOff((uint4)(heldNote >> 12), (uint4)(heldNote >> 8), (uint7)heldNote, (uint16)random.next32());
+    }
+    // a new note, not one that is already held
+    uint4 channel;
+    uint7 note;
+    do
+    {
+        channel = (uint4)random.next(16);
+        note = (uint7)random.next(128);
+    }
+    while (isNoteHeld(makeHeldNote(group, channel, note)));
+    heldNotes[heldNoteCount++] = makeHeldNote(group, channel, note);
+    return UMPacket().initNoteOn(group, channel, note, (uint16)(1 + random.next(0xFFFF)));
+}
+
+
+bool MIDI2WorkloadGenerator::isNoteHeld(uint16 heldNote) const
+{
+    // in the mixed profile, MPE notes share the channels
+    if (mpeNotes[(heldNote >> 12) & 0x0F][(heldNote >> 8) & 0x0F] == (byte)heldNote)
+    {
+        return true;
+    }
+    for (int i = 0; i < heldNoteCount; i++)
+    {
+        if (heldNotes[i] == heldNote)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+UMPacket MIDI2WorkloadGenerator::nextPerNoteControllerPacket(uint4 group)
+{
+    // a note on or off now and then, otherwise controllers for held notes
+    if (heldNoteCount == 0 || random.next(16) == 0)
+    {
+        return nextNotePacket(group);
+    }
+    // per-note messages go to the group of the held note
+    uint16 heldNote = heldNotes[random.next((uint32)heldNoteCount)];
+    group = (uint4)(heldNote >> 12);
+    uint4 channel = (uint4)(heldNote >> 8);
+    uint7 note = (uint7)heldNote;
+    switch (random.next(3))
+    {
+        case 0: return UMPacket().initPerNoteAssignableCC(group, channel, note, (uint7)random.next(128), random.next32());
+        case 1: return UMPacket().initPerNoteRegisteredCC(group, channel, note, (uint7)random.next(128), random.next32());
+        default:
+            return UMPacket((((uint32)UMPacket::M2ChannelVoice) << 28)
+                            | (((uint32)group & 0x0F) << 24)
+                            | (((uint32)UMPacket::M2StatusPerNotePitchBend) << 20)
+                            | (((uint32)channel & 0x0F) << 16)
+                            | (((uint32)note & 0x7F) << 8),
+                            random.next32());
+    }
+}
+
+
+UMPacket MIDI2WorkloadGenerator::nextMPEPacket(uint4 group)
+{
+    // channel 0 is the manager channel, 1..15 are member channels with one note each per group
+    uint4 channel = (uint4)(1 + random.next(15));
+    byte& mpeNote = mpeNotes[group][channel];
+    if (mpeNote == 0xFF)
+    {
+        uint7 note;
+        do
+        {
+            note = (uint7)random.next(128);
+        }
+        while (isNoteHeld(makeHeldNote(group, channel, note)));
+        mpeNote = note;
+        return UMPacket().initNoteOn(group, channel, note, (uint16)(1 + random.next(0xFFFF)));
+    }
+    uint32 r = random.next(32);
+    if (r == 0)
+    {
+        uint7 note = mpeNote;
+        mpeNote = 0xFF;
+        return UMPacket().initNoteOff(group, channel, note, 0);
+    }
+    if (r < 22)
+    {
+        return UMPacket().initPitchBend(group, channel, random.next32());
+    }
+    if (r < 27)
+    {
+        return UMPacket().initChannelPressure(group, channel, random.next32());
+    }
+    return UMPacket().initControlChange(group, channel, 74, random.next32());
+}
+
+
+UMPacket MIDI2WorkloadGenerator::nextSysExPacket(uint4 group)
+{
+    if (sysExBytesLeft == 0)
+    {
+        sysExBytesLeft = 16 + (int)random.next(MaxSysExBytes - 15);
+        sysExStarted = false;
+        sysExGroup = group;
+    }
+    byte bytes[UMPacket::SysEx7MaxBytesPerPacket];
+    int byteCount = (sysExBytesLeft < UMPacket::SysEx7MaxBytesPerPacket) ? sysExBytesLeft : UMPacket::SysEx7MaxBytesPerPacket;
+    uint64 r = random.next64();
+    for (int i = 0; i < byteCount; i++)
+    {
+        bytes[i] = (byte)(r >> (i * 8));
+    }
+    bool last = (sysExBytesLeft == byteCount);
+    UMPacket::SysEx7Status status;
+    if (!sysExStarted)
+    {
+        status = last ? UMPacket::SysEx7StatusComplete : UMPacket::SysEx7StatusStart;
+    }
+    else
+    {
+        status = last ? UMPacket::SysEx7StatusEnd : UMPacket::SysEx7StatusContinue;
+    }
+    sysExStarted = true;
+    sysExBytesLeft -= byteCount;
+    return UMPacket().initSysEx7(sysExGroup, status, bytes, byteCount);
+}
+
+
+//
+// MARK: sending
+//
+
+void MIDI2WorkloadGenerator::generate(uint64 count)
+{
+    UMPBlockBuffer buffer;
+    double unitsPerPacket = (packetsPerSecond > 0) ? (double)timestampUnitsPerSecond / packetsPerSecond : 0;
+    for (uint64 i = 0; i < count; i++)
+    {
+        UMPacket packet = nextPacket();
+        uint64 timestamp = (uint64)((double)packetCount * unitsPerPacket);
+        packetCount++;
+        int size = packet.getSizeInWords();
+        uint32 words[4] = { packet.getWord(0), packet.getWord(1), packet.getWord(2), packet.getWord(3) };
+        if (buffer.add(timestamp, words, size) == 0)
+        {
+            target.processBlock(buffer.getBlock());
+            buffer.clear();
+            buffer.add(timestamp, words, size);
+        }
+    }
+    if (!buffer.isEmpty())
+    {
+        target.processBlock(buffer.getBlock());
+    }
+}
+
+
+uint64 MIDI2WorkloadGenerator::run(double seconds)
+{
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+    uint64 startCount = packetCount;
+    uint64 totalCount = (packetsPerSecond > 0) ? (uint64)(seconds * packetsPerSecond) : 0;
+    while (true)
+    {
+        double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        if (packetsPerSecond <= 0)
+        {
+            if (elapsed >= seconds)
+            {
+                break;
+            }
+            generate(UMPBlockBuffer::MaxWords);
+            continue;
+        }
+        uint64 sent = packetCount - startCount;
+        if (sent >= totalCount)
+        {
+            break;
+        }
+        uint64 due = (uint64)(elapsed * packetsPerSecond);
+        if (due > totalCount)
+        {
+            due = totalCount;
+        }
+        if (due > sent)
+        {
+            generate(due - sent);
+        }
+        else
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(500));
+        }
+    }
+    return packetCount - startCount;
+}
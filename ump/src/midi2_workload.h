@@ -0,0 +1,134 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+
+#include "midi2.h"
+
+
+/**
+ * Generate synthetic UMP traffic for load tests and benchmarks.
+ *
+ * The packets follow one of several traffic profiles and are sent to the
+ * target in blocks via processBlock(). Timestamps are spaced according to
+ * the rate, starting at 0, so the same seed always produces the same
+ * packets with the same timestamps.
+ */
+class MIDI2WorkloadGenerator
+{
+public:
+    typedef enum
+    {
+        /** note on/off with random velocities, up to 16 notes held */
+        ProfileNotes,
+        /** per-note controllers and per-note pitch bend on held notes */
+        ProfilePerNoteControllers,
+        /** MPE-like: one note per member channel with pitch bend, pressure and CC 74 */
+        ProfileMPEPitchBend,
+        /** SysEx7 messages of 16..512 bytes in bursts of packets */
+        ProfileSysExBursts,
+        /** a random mix of all profiles above */
+        ProfileMixed,
+        ProfileCount
+    }
+    Profile;
+
+    static constexpr const char* profileNames[ProfileCount] =
+    {
+        "notes", "pernotecc", "mpe", "sysex", "mixed"
+    };
+
+    /** @return the profile with the given name, or -1 */
+    static int profileFromString(const char* name);
+
+    /**
+     * @param target receives all generated packets
+     * @param seed the random seed, the same seed gives the same packets
+     */
+    MIDI2WorkloadGenerator(MIDI2Processor& target, uint64 seed = 1);
+
+    void setProfile(Profile profile) { this->profile = profile; }
+    Profile getProfile() const { return profile; }
+
+    /** the generated packets use these groups (bit mask, default: group 0) */
+    void setGroups(uint16 groupMask);
+
+    /**
+     * @param packetsPerSecond the rate for the timestamps, and for run(); 0 means as fast as possible
+     * @param timestampUnitsPerSecond the unit of the timestamps
+     */
+    void setRate(double packetsPerSecond, uint64 timestampUnitsPerSecond = 1000000000);
+
+    /** restart with the same packets and timestamps */
+    void reset();
+
+    /** create the next packet, without sending it */
+    UMPacket nextPacket();
+
+    /** send the next count packets to the target, as fast as possible */
+    void generate(uint64 count);
+
+    /**
+     * send packets to the target in real time, at the set rate, for the
+     * given duration; without a rate, send as fast as possible.
+     * @return the number of packets sent
+     */
+    uint64 run(double seconds);
+
+    uint64 getPacketCount() const { return packetCount; }
+
+private:
+    static const int MaxHeldNotes = 16;
+    static const int MaxSysExBytes = 512;
+
+    uint4 nextGroup();
+    UMPacket nextNotePacket(uint4 group);
+    static uint16 makeHeldNote(uint4 group, uint4 channel, uint7 note)
+    {
+        return (uint16)(((group & 0x0F) << 12) | ((channel & 0x0F) << 8) | (note & 0x7F));
+    }
+    bool isNoteHeld(uint16 heldNote) const;
+    UMPacket nextPerNoteControllerPacket(uint4 group);
+    UMPacket nextMPEPacket(uint4 group);
+    UMPacket nextSysExPacket(uint4 group);
+
+    MIDI2Processor& target;
+    uint64 seed;
+    MIDI2Random random;
+    Profile profile;
+    byte groups[16];
+    int groupCount;
+    double packetsPerSecond;
+    uint64 timestampUnitsPerSecond;
+    uint64 packetCount;
+
+    // held notes, as (group << 12) | (channel << 8) | note
+    uint16 heldNotes[MaxHeldNotes];
+    int heldNoteCount;
+    // MPE: note held on [group][member channel 1..15], or 0xFF
+    byte mpeNotes[16][16];
+    // the remaining bytes of the current SysEx message, the first packet is sent as Start
+    int sysExBytesLeft;
+    bool sysExStarted;
+    uint4 sysExGroup;
+};
@@ -0,0 +1,699 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "../src/debug.h"
+#include "../src/midi2.h"
+#include "../src/midi2_codec.h"
+#include "../src/midi2_dispatcher.h"
+#include "../src/midi2_translation.h"
+#include "../src/midi2_workload.h"
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Benchmark the UMP core: packet builders, raw UMP framing, MIDI 1.0 <->
+ * MIDI 2.0 translation, value scaling, and packet formatting, with several
+ * traffic mixes. Block processing, dispatching, and MIDI2StreamCodec
+ * encoding and decoding are benchmarked with the traffic profiles of
+ * MIDI2WorkloadGenerator. Results can be saved and
+ * compared against a baseline.
+ *
+ * Linux build:
+ *   g++ -std=gnu++17 -O2 -o ump_bench main.cpp ../src/midi2.cpp ../src/midi2_translation.cpp
+ *       ../src/midi2_support.cpp ../src/midi2_dispatcher.cpp ../src/midi2_workload.cpp ../src/midi2_codec.cpp
+ *
+ * Typical use:
+ *   ./ump_bench -o baseline.csv
+ *   (change the code)
+ *   ./ump_bench -b baseline.csv
+ */
+
+// default number of packets per run
+#define DEFAULT_PACKET_COUNT  (100000)
+
+// default number of runs per benchmark; the fastest run is reported
+#define DEFAULT_REPEATS       (5)
+
+// default slowdown in percent reported as regression
+#define DEFAULT_THRESHOLD     (10.0)
+
+typedef std::chrono::steady_clock Clock;
+
+
+/** kinds of generated events */
+typedef enum
+{
+    EventNoteOn,
+    EventNoteOff,
+    EventControlChange,
+    EventPitchBend,
+    EventProgramChange,
+    EventChannelPressure,
+    EventSysEx,
+    EventKindCount
+}
+EventKind;
+
+
+/** a generated event, from which packets and MIDI 1.0 messages are built */
+struct Event
+{
+    EventKind kind;
+    uint4 channel;
+    uint7 data1;
+    uint16 value14;
+};
+
+
+/** a traffic mix: the relative weight of every event kind */
+struct Mix
+{
+    const char* name;
+    int weights[EventKindCount];
+};
+
+
+static const Mix mixes[] =
+{
+    //                   on  off  cc  pb  pc  cp  sysex
+    { "notes",         { 50, 50,  0,  0,  0,  0,  0 } },
+    { "controllers",   {  0,  0, 60, 30,  0, 10,  0 } },
+    { "mixed",         { 25, 25, 25, 10,  5,  5,  5 } },
+};
+
+
+static void generateEvents(const Mix& mix, std::vector<Event>& events, int count)
+{
+    int totalWeight = 0;
+    for (int weight : mix.weights)
+    {
+        totalWeight += weight;
+    }
+    MIDI2Random random(12345);
+    events.resize((size_t)count);
+    for (Event& event : events)
+    {
+        int r = (int)random.next((uint32)totalWeight);
+        int kind = 0;
+        while (r >= mix.weights[kind])
+        {
+            r -= mix.weights[kind];
+            kind++;
+        }
+        event.kind = (EventKind)kind;
+        event.channel = (uint4)random.next(16);
+        event.data1 = (uint7)random.next(128);
+        event.value14 = (uint16)random.next(0x4000);
+    }
+}
+
+
+static UMPacket buildPacket(const Event& event)
+{
+    static const byte sysex[6] = { 0x7E, 0x7F, 0x06, 0x01, 0x00, 0x00 };
+    uint4 group = 0;
+    uint32 value32 = (uint32)event.value14 << 18;
+    UMPacket packet;
+    switch (event.kind)
+    {
+        case EventNoteOn: packet.initNoteOn(group, event.channel, event.data1, (uint16)(event.value14 << 2)); break;
+        case EventNoteOff: packet.initNoteOff(group, event.channel, event.data1, 0); break;
+        case EventControlChange: packet.initControlChange(group, event.channel, event.data1, value32); break;
+        case EventPitchBend: packet.initPitchBend(group, event.channel, value32); break;
+        case EventProgramChange: packet.initProgramChange(group, event.channel, 0, event.data1, 0, 0); break;
+        case EventChannelPressure: packet.initChannelPressure(group, event.channel, value32); break;
+        case EventSysEx: packet.initSysEx7(group, UMPacket::SysEx7StatusComplete, sysex, 6); break;
+        default: break;
+    }
+    return packet;
+}
+
+
+/** a MIDI 1.0 message built from an event */
+struct MIDI1Message
+{
+    byte data[8];
+    int length;
+};
+
+
+static MIDI1Message buildMIDI1Message(const Event& event)
+{
+    MIDI1Message message;
+    byte lsb = (byte)(event.value14 & 0x7F);
+    byte msb = (byte)(event.value14 >> 7);
+    byte* d = message.data;
+    switch (event.kind)
+    {
+        case EventNoteOn: d[0] = MIDI_NOTEON; d[1] = event.data1; d[2] = (byte)(msb | 1); message.length = 3; break;
+        case EventNoteOff: d[0] = MIDI_NOTEOFF; d[1] = event.data1; d[2] = 0; message.length = 3; break;
+        case EventControlChange: d[0] = MIDI_CONTROLCHANGE; d[1] = event.data1; d[2] = msb; message.length = 3; break;
+        case EventPitchBend: d[0] = MIDI_PITCHBEND; d[1] = lsb; d[2] = msb; message.length = 3; break;
+        case EventProgramChange: d[0] = MIDI_PROGRAMCHANGE; d[1] = event.data1; message.length = 2; break;
+        case EventChannelPressure: d[0] = MIDI_CHANAFTERTOUCH; d[1] = msb; message.length = 2; break;
+        default:
+            // short SysEx: Universal Non-Realtime, Identity Request
+            d[0] = MIDI_BEGINSYSEX; d[1] = 0x7E; d[2] = 0x7F; d[3] = 0x06; d[4] = 0x01; d[5] = MIDI_ENDSYSEX;
+            message.length = 6;
+            return message;
+    }
+    d[0] |= event.channel;
+    return message;
+}
+
+
+//
+// MARK: Sinks
+//
+
+/** counts the packets, so that the work cannot be optimized away */
+class CountingSink
+    : public MIDI2Processor
+{
+public:
+    using MIDI2Processor::process;
+    void process(uint64 timestamp, const UMPacket& packet) override { (void)timestamp; count += packet.getWord(0) != 0; }
+    void process(uint64 timestamp, UMPView packet) override { (void)timestamp; count += packet.getWord(0) != 0; }
+    uint64 count = 0;
+};
+
+
+/** counts the words of all blocks, without looking at the packets */
+class BlockCountingSink
+    : public MIDI2Processor
+{
+public:
+    using MIDI2Processor::process;
+    void process(uint64 timestamp, const UMPacket& packet) override { (void)timestamp; (void)packet; }
+    void processBlock(const UMPBlock& block) override { count += (uint64)block.getSizeInWords() + block.getWords()[0]; }
+    uint64 count = 0;
+};
+
+
+/** keeps a copy of all blocks, to replay them later */
+class BlockRecorder
+    : public MIDI2Processor
+{
+public:
+    struct Block
+    {
+        size_t wordOffset;
+        size_t packetOffset;
+        int sizeInWords;
+        int packetCount;
+    };
+
+    using MIDI2Processor::process;
+    void process(uint64 timestamp, const UMPacket& packet) override { (void)timestamp; (void)packet; }
+    void process(uint64 timestamp, UMPView packet) override { (void)timestamp; (void)packet; }
+
+    void processBlock(const UMPBlock& block) override
+    {
+        Block b = { words.size(), timestamps.size(), block.getSizeInWords(), 0 };
+        forEachPacket(block, [&](uint64 timestamp, UMPView packet)
+        {
+            timestamps.push_back(timestamp);
+            b.packetCount++;
+            (void)packet;
+        });
+        words.insert(words.end(), block.getWords(), block.getWords() + block.getSizeInWords());
+        blocks.push_back(b);
+    }
+
+    UMPBlock getBlock(const Block& b) const
+    {
+        return UMPBlock(&words[b.wordOffset], b.sizeInWords, &timestamps[b.packetOffset], b.packetCount);
+    }
+
+    std::vector<uint32> words;
+    std::vector<uint64> timestamps;
+    std::vector<Block> blocks;
+};
+
+
+class CountingListener
+    : public MIDI2Translator::Listener
+{
+public:
+    void translatedMessage(const UMPacket& packet) override { count += packet.getWord(0) != 0; }
+    void translatedMessage(const byte* data, int length, uint4 midi2Group) override { (void)midi2Group; count += (uint64)length + data[0]; }
+    uint64 count = 0;
+};
+
+
+//
+// MARK: Benchmarks
+//
+
+/** the data of one mix, prepared for all benchmarks */
+struct Workload
+{
+    std::vector<Event> events;
+    std::vector<UMPacket> packets;
+    std::vector<uint32> rawWords;
+    std::vector<MIDI1Message> midi1Messages;
+};
+
+
+typedef uint64 (*BenchmarkFunction)(const Workload& workload);
+
+
+static uint64 benchmarkInit(const Workload& workload)
+{
+    uint64 sum = 0;
+    for (const Event& event : workload.events)
+    {
+        sum += buildPacket(event).getWord(0);
+    }
+    return sum;
+}
+
+
+static uint64 benchmarkFraming(const Workload& workload)
+{
+    CountingSink sink;
+    sink.processRawUMP(0, workload.rawWords.data(), (int)workload.rawWords.size());
+    return sink.count;
+}
+
+
+static uint64 benchmarkMIDI1Received(const Workload& workload)
+{
+    CountingListener listener;
+    MIDI2Translator translator(&listener);
+    for (const MIDI1Message& message : workload.midi1Messages)
+    {
+        translator.midi1Received(message.data, message.length);
+    }
+    return listener.count;
+}
+
+
+static uint64 benchmarkUMPReceived(const Workload& workload)
+{
+    CountingListener listener;
+    MIDI2Translator translator(&listener);
+    for (const UMPacket& packet : workload.packets)
+    {
+        translator.umpReceived(packet);
+    }
+    return listener.count;
+}
+
+
+static uint64 benchmarkConvert(const Workload& workload)
+{
+    uint64 sum = 0;
+    for (const Event& event : workload.events)
+    {
+        sum += MIDI2Translator::convert7to32(event.data1);
+        sum += MIDI2Translator::convert14to32(event.value14);
+    }
+    return sum;
+}
+
+
+static uint64 benchmarkToString(const Workload& workload)
+{
+    uint64 sum = 0;
+    for (const UMPacket& packet : workload.packets)
+    {
+        sum += strlen(packet.toString());
+    }
+    return sum;
+}
+
+
+static uint64 benchmarkFormat(const Workload& workload)
+{
+    uint64 sum = 0;
+    char buffer[UMPacket::MaxFormattedLength];
+    for (const UMPacket& packet : workload.packets)
+    {
+        sum += (uint64)packet.format(buffer, sizeof(buffer));
+    }
+    return sum;
+}
+
+
+struct Benchmark
+{
+    const char* name;
+    BenchmarkFunction function;
+};
+
+
+/** the blocks generated by MIDI2WorkloadGenerator for one profile */
+struct ProfileWorkload
+{
+    MIDI2WorkloadGenerator::Profile profile;
+    int packetCount;
+    BlockRecorder recorder;
+    /** all packets, encoded with MIDI2StreamCodec */
+    std::vector<byte> encoded;
+};
+
+
+typedef uint64 (*ProfileBenchmarkFunction)(const ProfileWorkload& workload);
+
+
+static uint64 benchmarkGenerate(const ProfileWorkload& workload)
+{
+    CountingSink sink;
+    MIDI2WorkloadGenerator generator(sink, 12345);
+    generator.setProfile(workload.profile);
+    generator.setRate(10000);
+    generator.generate((uint64)workload.packetCount);
+    return sink.count;
+}
+
+
+static uint64 benchmarkProcessBlock(const ProfileWorkload& workload)
+{
+    CountingSink sink;
+    for (const BlockRecorder::Block& block : workload.recorder.blocks)
+    {
+        sink.processBlock(workload.recorder.getBlock(block));
+    }
+    return sink.count;
+}
+
+
+static uint64 benchmarkDispatch(const ProfileWorkload& workload)
+{
+    uint64 count = 0;
+    auto onPacket = [&](uint64 timestamp, UMPView packet) { (void)timestamp; count += packet.getWord1() != 0; };
+    auto onNoteOn = [&](uint64 timestamp, UMPView packet) { (void)timestamp; count += packet.getWord2() >> 16; };
+    MIDI2Dispatcher dispatcher;
+    dispatcher.setHandler(UMPacket::M2ChannelVoice, MIDI2Dispatcher::AnyStatus, onPacket);
+    dispatcher.setHandler(UMPacket::M2ChannelVoice, UMPacket::M2StatusNoteOn, onNoteOn);
+    dispatcher.setHandler(UMPacket::Data64, MIDI2Dispatcher::AnyStatus, onPacket);
+    for (const BlockRecorder::Block& block : workload.recorder.blocks)
+    {
+        dispatcher.processBlock(workload.recorder.getBlock(block));
+    }
+    return count;
+}
+
+
+static uint64 benchmarkEncode(const ProfileWorkload& workload)
+{
+    MIDI2StreamCodec codec;
+    byte buffer[MIDI2StreamCodec::MaxEncodedPacketSize];
+    uint64 sum = 0;
+    for (const BlockRecorder::Block& block : workload.recorder.blocks)
+    {
+        UMPBlock umpBlock = workload.recorder.getBlock(block);
+        const uint32* words = umpBlock.getWords();
+        for (int i = 0, pos = 0; i < umpBlock.getPacketCount(); i++)
+        {
+            UMPView packet(words + pos, UMPacket::wordToSize(words[pos]));
+            sum += (uint64)codec.encode(umpBlock.getTimestamp(i), packet, buffer, sizeof(buffer));
+            pos += packet.getSizeInWords();
+        }
+    }
+    return sum;
+}
+
+
+static uint64 benchmarkDecode(const ProfileWorkload& workload)
+{
+    BlockCountingSink sink;
+    MIDI2StreamCodec codec;
+    codec.decode(workload.encoded.data(), (int)workload.encoded.size(), sink);
+    return sink.count;
+}
+
+
+struct ProfileBenchmark
+{
+    const char* name;
+    ProfileBenchmarkFunction function;
+};
+
+
+static const Benchmark benchmarks[] =
+{
+    { "init",           benchmarkInit },
+    { "processRawUMP",  benchmarkFraming },
+    { "midi1Received",  benchmarkMIDI1Received },
+    { "umpReceived",    benchmarkUMPReceived },
+    { "convert",        benchmarkConvert },
+    { "toString",       benchmarkToString },
+    { "format",         benchmarkFormat },
+};
+
+
+static const ProfileBenchmark profileBenchmarks[] =
+{
+    { "generate",       benchmarkGenerate },
+    { "processBlock",   benchmarkProcessBlock },
+    { "dispatch",       benchmarkDispatch },
+    { "encode",         benchmarkEncode },
+    { "decode",         benchmarkDecode },
+};
+
+
+/** @return the fastest run in nanoseconds per packet */
+template<class Function, class WorkloadType>
+static double runBenchmark(Function function, const WorkloadType& workload, int packetCount, int repeats)
+{
+    static volatile uint64 result = 0;
+    double best = 0;
+    for (int i = 0; i < repeats; i++)
+    {
+        Clock::time_point start = Clock::now();
+        result = result + function(workload);
+        double nanos = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+        double nanosPerPacket = nanos / (double)packetCount;
+        if (i == 0 || nanosPerPacket < best)
+        {
+            best = nanosPerPacket;
+        }
+    }
+    return best;
+}
+
+
+//
+// MARK: Results
+//
+
+/** read a results file written with -o: benchmark/mix -> ns per packet */
+static bool loadResults(const char* path, std::map<std::string, double>& results)
+{
+    FILE* file = fopen(path, "r");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), file) != nullptr)
+    {
+        char benchmark[64], mix[64];
+        double nanosPerPacket;
+        if (sscanf(line, "%63[^,],%63[^,],%lf", benchmark, mix, &nanosPerPacket) == 3)
+        {
+            results[std::string(benchmark) + "/" + mix] = nanosPerPacket;
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+
+/** print one result, compared to the baseline, and save it. @return true for a regression */
+static bool reportResult(const char* benchmarkName, const char* mixName, double nanosPerPacket,
+                         const std::map<std::string, double>& baseline, double threshold, FILE* output)
+{
+    double packetsPerSecond = nanosPerPacket > 0 ? 1e9 / nanosPerPacket : 0;
+    char comparison[64] = "";
+    bool regression = false;
+    auto it = baseline.find(std::string(benchmarkName) + "/" + mixName);
+    if (it != baseline.end() && it->second > 0)
+    {
+        double change = (nanosPerPacket - it->second) * 100.0 / it->second;
+        regression = change > threshold;
+        snprintf(comparison, sizeof(comparison), "%+7.1f%%%s", change, regression ? " REGRESSION" : "");
+    }
+    PRINT("%-16s %-16s %12.2f %14.0f %s", benchmarkName, mixName, nanosPerPacket, packetsPerSecond, comparison);
+    if (output != nullptr)
+    {
+        fprintf(output, "%s,%s,%.3f,%.0f\n", benchmarkName, mixName, nanosPerPacket, packetsPerSecond);
+    }
+    return regression;
+}
+
+
+static void printUsage()
+{
+    PRINT1("Usage: ump_bench [options]");
+    PRINT1("  -n <packets>   packets per run (default: 100000)");
+    PRINT1("  -r <repeats>   runs per benchmark, the fastest is reported (default: 5)");
+    PRINT1("  -m <mix>       only run this traffic mix: notes, controllers, mixed (default: all)");
+    PRINT1("                 or this workload profile: notes, pernotecc, mpe, sysex, mixed");
+    PRINT1("  -o <file>      save the results as CSV");
+    PRINT1("  -b <file>      compare against results saved with -o");
+    PRINT1("  -t <percent>   slowdown reported as regression (default: 10)");
+}
+
+
+int main(int argc, char** argv)
+{
+    int packetCount = DEFAULT_PACKET_COUNT;
+    int repeats = DEFAULT_REPEATS;
+    double threshold = DEFAULT_THRESHOLD;
+    const char* mixName = nullptr;
+    const char* outputPath = nullptr;
+    const char* baselinePath = nullptr;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        if (arg[0] == '-' && i + 1 < argc)
+        {
+            const char* value = argv[++i];
+            switch (arg[1])
+            {
+                case 'n': packetCount = atoi(value); break;
+                case 'r': repeats = atoi(value); break;
+                case 'm': mixName = value; break;
+                case 'o': outputPath = value; break;
+                case 'b': baselinePath = value; break;
+                case 't': threshold = atof(value); break;
+                default: printUsage(); return 1;
+            }
+        }
+        else
+        {
+            printUsage();
+            return 1;
+        }
+    }
+    if (packetCount <= 0 || repeats <= 0)
+    {
+        printUsage();
+        return 1;
+    }
+
+    std::map<std::string, double> baseline;
+    if (baselinePath != nullptr && !loadResults(baselinePath, baseline))
+    {
+        PRINT("ERROR: cannot read baseline %s", baselinePath);
+        return 1;
+    }
+    FILE* output = nullptr;
+    if (outputPath != nullptr)
+    {
+        output = fopen(outputPath, "w");
+        if (output == nullptr)
+        {
+            PRINT("ERROR: cannot create %s", outputPath);
+            return 1;
+        }
+        fprintf(output, "benchmark,mix,ns_per_packet,packets_per_second\n");
+    }
+
+    int regressions = 0;
+    PRINT("%-16s %-16s %12s %14s", "benchmark", "mix", "ns/packet", "packets/s");
+    for (const Mix& mix : mixes)
+    {
+        if (mixName != nullptr && strcmp(mixName, mix.name) != 0)
+        {
+            continue;
+        }
+        Workload workload;
+        generateEvents(mix, workload.events, packetCount);
+        for (const Event& event : workload.events)
+        {
+            UMPacket packet = buildPacket(event);
+            workload.packets.push_back(packet);
+            for (int w = 0; w < packet.getSizeInWords(); w++)
+            {
+                workload.rawWords.push_back(packet.getWord(w));
+            }
+            workload.midi1Messages.push_back(buildMIDI1Message(event));
+        }
+
+        for (const Benchmark& benchmark : benchmarks)
+        {
+            double nanosPerPacket = runBenchmark(benchmark.function, workload, packetCount, repeats);
+            regressions += reportResult(benchmark.name, mix.name, nanosPerPacket, baseline, threshold, output) ? 1 : 0;
+        }
+    }
+
+    // the workload generator profiles, stored in the results as "profile:<name>"
+    for (int p = 0; p < MIDI2WorkloadGenerator::ProfileCount; p++)
+    {
+        const char* profileName = MIDI2WorkloadGenerator::profileNames[p];
+        if (mixName != nullptr && strcmp(mixName, profileName) != 0)
+        {
+            continue;
+        }
+        ProfileWorkload workload;
+        workload.profile = (MIDI2WorkloadGenerator::Profile)p;
+        workload.packetCount = packetCount;
+        MIDI2WorkloadGenerator generator(workload.recorder, 12345);
+        generator.setProfile(workload.profile);
+        generator.setRate(10000);
+        generator.generate((uint64)packetCount);
+        MIDI2StreamCodec codec;
+        byte buffer[MIDI2StreamCodec::MaxEncodedPacketSize];
+        for (const BlockRecorder::Block& block : workload.recorder.blocks)
+        {
+            UMPBlock umpBlock = workload.recorder.getBlock(block);
+            const uint32* words = umpBlock.getWords();
+            for (int i = 0, pos = 0; i < umpBlock.getPacketCount(); i++)
+            {
+                UMPView packet(words + pos, UMPacket::wordToSize(words[pos]));
+                int size = codec.encode(umpBlock.getTimestamp(i), packet, buffer, sizeof(buffer));
+                workload.encoded.insert(workload.encoded.end(), buffer, buffer + size);
+                pos += packet.getSizeInWords();
+            }
+        }
+
+        std::string name = std::string("profile:") + profileName;
+        for (const ProfileBenchmark& benchmark : profileBenchmarks)
+        {
+            double nanosPerPacket = runBenchmark(benchmark.function, workload, packetCount, repeats);
+            regressions += reportResult(benchmark.name, name.c_str(), nanosPerPacket, baseline, threshold, output) ? 1 : 0;
+        }
+    }
+
+    if (output != nullptr)
+    {
+        fclose(output);
+        PRINT("Results saved to %s", outputPath);
+    }
+    if (regressions > 0)
+    {
+        PRINT("%d regression(s) above %.1f%%", regressions, threshold);
+        return 2;
+    }
+    return 0;
+}
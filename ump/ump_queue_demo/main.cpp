@@ -0,0 +1,146 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without 
+ * restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be 
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "../src/debug.h"
+#include "../src/midi2.h"
+#include "../src/midi2_queue.h"
+#include <chrono>
+#include <thread>
+#include <stdlib.h>
+
+/*
+ * Pass packets from a synthetic producer thread through a MIDI2PacketQueue
+ * to a MIDI2QueueWorker, like a MIDI input callback would, and check that
+ * every packet arrives complete, unchanged, and in order.
+ *
+ * Linux build:
+ *   g++ -std=gnu++17 -O2 -o ump_queue_demo main.cpp ../src/midi2.cpp ../src/midi2_queue.cpp -lpthread
+ */
+
+// default number of packets sent by the producer
+#define DEFAULT_PACKET_COUNT  (10000000)
+
+// default queue size in words
+#define DEFAULT_QUEUE_WORDS   (16384)
+
+typedef std::chrono::steady_clock Clock;
+
+
+/**
+ * Packet number n has message type 2, 4, or 5 (1, 2, or 4 words), in turn.
+ * The lower 28 bits of word 1 are n, the other words are n ^ word index,
+ * and the timestamp is n.
+ */
+static int makePacket(uint64 n, uint32* words)
+{
+    static const uint32 messageTypes[3] = { UMPacket::M1ChannelVoice, UMPacket::M2ChannelVoice, UMPacket::Data128 };
+    words[0] = (messageTypes[n % 3] << 28) | (uint32)(n & 0x0FFFFFFF);
+    int sizeInWords = UMPacket::wordToSize(words[0]);
+    for (int i = 1; i < sizeInWords; i++)
+    {
+        words[i] = (uint32)n ^ (uint32)i;
+    }
+    return sizeInWords;
+}
+
+
+/** checks the packets on the worker thread */
+class CheckingSink
+    : public MIDI2Processor
+{
+public:
+    using MIDI2Processor::process;
+
+    void process(uint64 timestamp, const UMPacket& packet) override { process(timestamp, UMPView(packet)); }
+
+    void process(uint64 timestamp, UMPView packet) override
+    {
+        uint32 expected[4];
+        int sizeInWords = makePacket(received, expected);
+        bool ok = (timestamp == received && packet.getSizeInWords() == sizeInWords);
+        for (int i = 0; ok && i < sizeInWords; i++)
+        {
+            ok = (packet.getWord(i) == expected[i]);
+        }
+        if (!ok)
+        {
+            errors++;
+        }
+        received++;
+    }
+
+    uint64 received = 0;
+    uint64 errors = 0;
+};
+
+
+int main(int argc, char** argv)
+{
+    uint64 packetCount = (argc > 1) ? strtoull(argv[1], nullptr, 10) : DEFAULT_PACKET_COUNT;
+    int queueWords = (argc > 2) ? atoi(argv[2]) : DEFAULT_QUEUE_WORDS;
+    if (packetCount == 0 || queueWords <= 0)
+    {
+        PRINT1("Usage: ump_queue_demo [packet count] [queue size in words]");
+        return 1;
+    }
+
+    MIDI2PacketQueue queue(queueWords);
+    CheckingSink sink;
+    MIDI2QueueWorker worker;
+
+    // a packet with a size not matching its message type must be rejected
+    uint32 wrongSize[2] = { (uint32)UMPacket::M1ChannelVoice << 28, 0 };
+    if (queue.write(0, wrongSize, 2) || queue.getInvalidPacketCount() != 1)
+    {
+        PRINT1("ERROR: packet with wrong size was not rejected");
+        return 1;
+    }
+
+    Clock::time_point start = Clock::now();
+    worker.start(queue, sink, 100);
+    uint64 retries = 0;
+    std::thread producer([&]()
+    {
+        uint32 words[4];
+        for (uint64 n = 0; n < packetCount; n++)
+        {
+            int sizeInWords = makePacket(n, words);
+            // a real input would drop the packet, here wait for the worker
+            while (!queue.write(n, words, sizeInWords))
+            {
+                retries++;
+                std::this_thread::yield();
+            }
+        }
+    });
+    producer.join();
+    worker.stop();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    PRINT("Packets:        %llu sent, %llu received, %llu errors", packetCount, sink.received, sink.errors);
+    PRINT("Queue full:     %llu times", retries);
+    PRINT("Throughput:     %.0f packets/s (%.1f ns/packet)", sink.received / seconds, seconds * 1e9 / sink.received);
+    bool ok = (sink.received == packetCount && sink.errors == 0);
+    PRINT("%s", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
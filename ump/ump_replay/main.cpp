@@ -0,0 +1,347 @@
+/*
+ * Copyright © 2021-2022 by Florian Bomers, Bome Software GmbH & Co. KG
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "../src/debug.h"
+#include "../src/midi2.h"
+#include "../src/midi2_capture.h"
+#include "../src/midi2_filter.h"
+#include "../src/midi2_printer.h"
+#ifdef TARGET_APPLE
+#include "../src/midi2_apple_output.h"
+#endif
+#include <chrono>
+#include <thread>
+
+/*
+ * Replay a capture file written by MIDI2CaptureWriter, with the original
+ * timing between packets, and report the achieved timing accuracy.
+ *
+ * Linux build:
+ *   g++ -std=gnu++17 -O2 -o ump_replay main.cpp ../src/midi2.cpp ../src/midi2_capture.cpp ../src/midi2_codec.cpp
+ *       ../src/midi2_filter.cpp ../src/midi2_framing.cpp ../src/midi2_printer.cpp -lpthread
+ */
+
+#define VIRTUAL_PORT_NAME  "UMP Replay"
+
+// sleep until this long before a packet is due, then spin
+#define SPIN_MICROS        (1000)
+
+// timing error histogram: bucket 0 is < 1us, bucket n is < 2^n us
+#define HISTOGRAM_BUCKETS  (24)
+
+typedef std::chrono::steady_clock Clock;
+
+
+/** a sink which only counts the packets */
+class NullSink
+    : public MIDI2Processor
+{
+public:
+    using MIDI2Processor::process;
+    void process(uint64 timestamp, const UMPacket& packet) override { (void)timestamp; (void)packet; }
+    void process(uint64 timestamp, UMPView packet) override { (void)timestamp; (void)packet; }
+};
+
+
+#ifdef TARGET_APPLE
+/** send the packets to a Core MIDI output, immediately */
+class AppleOutputSink
+    : public MIDI2Processor
+{
+public:
+    AppleOutputSink(MIDI2AppleOutput& _output) : output(_output) {}
+    using MIDI2Processor::process;
+    void process(uint64 timestamp, const UMPacket& packet) override { (void)timestamp; output.send(packet); }
+    void process(uint64 timestamp, UMPView packet) override { (void)timestamp; output.send(packet.getData(), packet.getSizeInWords()); }
+private:
+    MIDI2AppleOutput& output;
+};
+#endif
+
+
+/** @return the bit mask of a comma separated list of numbers 0..15 */
+static uint16 parseMask(const char* list)
+{
+    uint16 mask = 0;
+    while (*list != 0)
+    {
+        int n = atoi(list);
+        if (n >= 0 && n <= 15)
+        {
+            mask |= (uint16)(1 << n);
+        }
+        while (*list != 0 && *list != ',')
+        {
+            list++;
+        }
+        if (*list == ',')
+        {
+            list++;
+        }
+    }
+    return mask;
+}
+
+
+static void printUsage()
+{
+    PRINT1("Usage: ump_replay [options] <capture file>");
+    PRINT1("  -s <speed>     speed factor, e.g. 0.5, 1, 10; 0 = as fast as possible (default: 1)");
+    PRINT1("  -g <groups>    only replay these groups, e.g. 0,1,5 (default: all)");
+    PRINT1("  -c <channels>  only replay channel voice messages on these channels (default: all)");
+    PRINT1("  -u <units>     timestamp units per second (default: from file, or 1000000000)");
+    PRINT1("  -o <output>    null, print, file:<path>");
+#ifdef TARGET_APPLE
+    PRINT1("                 virtual, device:<index> (default: null)");
+#else
+    PRINT1("                 (default: null)");
+#endif
+}
+
+
+static void printHistogram(const uint64* histogram, uint64 total)
+{
+    PRINT1("Timing error histogram:");
+    uint64 sum = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        if (histogram[i] == 0)
+        {
+            continue;
+        }
+        sum += histogram[i];
+        char range[40];
+        if (i == 0)
+        {
+            snprintf(range, sizeof(range), "< 1us");
+        }
+        else if (i == HISTOGRAM_BUCKETS - 1)
+        {
+            snprintf(range, sizeof(range), ">= %lluus", 1ULL << (i - 1));
+        }
+        else
+        {
+            snprintf(range, sizeof(range), "< %lluus", 1ULL << i);
+        }
+        char bar[51];
+        int barLength = (int)(histogram[i] * 50 / total);
+        memset(bar, '#', (size_t)barLength);
+        bar[barLength] = 0;
+        PRINT("  %12s: %10llu %6.2f%% (cum. %6.2f%%) %s", range, histogram[i],
+              histogram[i] * 100.0 / total, sum * 100.0 / total, bar);
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    double speed = 1.0;
+    uint16 groups = 0xFFFF;
+    uint16 channels = 0xFFFF;
+    uint64 unitsPerSecond = 0;
+    const char* outputName = "null";
+    const char* path = nullptr;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        if (arg[0] == '-' && i + 1 < argc)
+        {
+            const char* value = argv[++i];
+            switch (arg[1])
+            {
+                case 's': speed = atof(value); break;
+                case 'g': groups = parseMask(value); break;
+                case 'c': channels = parseMask(value); break;
+                case 'u': unitsPerSecond = strtoull(value, nullptr, 10); break;
+                case 'o': outputName = value; break;
+                default: printUsage(); return 1;
+            }
+        }
+        else if (arg[0] != '-' && path == nullptr)
+        {
+            path = arg;
+        }
+        else
+        {
+            printUsage();
+            return 1;
+        }
+    }
+    if (path == nullptr || speed < 0)
+    {
+        printUsage();
+        return 1;
+    }
+
+    MIDI2CaptureReader reader;
+    if (!reader.open(path))
+    {
+        PRINT("ERROR: cannot open capture file %s", path);
+        return 1;
+    }
+    if (unitsPerSecond == 0)
+    {
+        unitsPerSecond = reader.getTimestampUnitsPerSecond();
+        if (unitsPerSecond == 0)
+        {
+            unitsPerSecond = 1000000000;
+        }
+    }
+
+    // output
+    NullSink nullSink;
+    MIDI2Printer printer;
+    MIDI2CaptureWriter writer;
+    MIDI2Processor* sink = &nullSink;
+#ifdef TARGET_APPLE
+    MIDI2AppleOutput outputDevice;
+    AppleOutputSink outputSink(outputDevice);
+#endif
+    if (strcmp(outputName, "print") == 0)
+    {
+        sink = &printer;
+    }
+    else if (strncmp(outputName, "file:", 5) == 0)
+    {
+        if (!writer.open(outputName + 5, unitsPerSecond))
+        {
+            PRINT("ERROR: cannot create capture file %s", outputName + 5);
+            return 1;
+        }
+        sink = &writer;
+    }
+#ifdef TARGET_APPLE
+    else if (strcmp(outputName, "virtual") == 0 || strncmp(outputName, "device:", 7) == 0)
+    {
+        bool ok = (outputName[0] == 'v')
+            ? outputDevice.openVirtualPort(VIRTUAL_PORT_NAME)
+            : outputDevice.open(atoi(outputName + 7));
+        if (!ok)
+        {
+            PRINT("ERROR: cannot open output %s", outputName);
+            return 1;
+        }
+        sink = &outputSink;
+    }
+#endif
+    else if (strcmp(outputName, "null") != 0)
+    {
+        printUsage();
+        return 1;
+    }
+
+    MIDI2Filter filter(*sink);
+    if (groups != 0xFFFF || channels != 0xFFFF)
+    {
+        MIDI2Filter::Rule rule;
+        rule.groups = groups;
+        rule.channels = channels;
+        filter.addRule(rule);
+    }
+
+    if (speed > 0)
+    {
+        PRINT("Replaying %llu packets at %.2fx speed...", reader.getPacketCount(), speed);
+    }
+    else
+    {
+        PRINT("Replaying %llu packets as fast as possible...", reader.getPacketCount());
+    }
+
+    uint64 histogram[HISTOGRAM_BUCKETS] = {};
+    uint64 sentPackets = 0;
+    uint64 sentWords = 0;
+    uint64 maxErrorMicros = 0;
+    double totalErrorMicros = 0;
+    // nanoseconds of replay time per timestamp unit
+    double nanosPerUnit = (speed > 0) ? 1000000000.0 / ((double)unitsPerSecond * speed) : 0;
+
+    uint64 timestamp;
+    UMPView packet;
+    uint64 firstTimestamp = 0;
+    bool first = true;
+    Clock::time_point start = Clock::now();
+    while (reader.next(timestamp, packet))
+    {
+        if (!filter.accepts(packet.getWord1()))
+        {
+            continue;
+        }
+        if (first)
+        {
+            firstTimestamp = timestamp;
+            start = Clock::now();
+            first = false;
+        }
+        if (speed > 0)
+        {
+            // timestamps before the first packet are sent immediately
+            int64 nanos = (timestamp > firstTimestamp) ? (int64)((timestamp - firstTimestamp) * nanosPerUnit) : 0;
+            Clock::time_point due = start + std::chrono::nanoseconds(nanos);
+            Clock::time_point now = Clock::now();
+            if (due - now > std::chrono::microseconds(SPIN_MICROS))
+            {
+                std::this_thread::sleep_until(due - std::chrono::microseconds(SPIN_MICROS));
+            }
+            while ((now = Clock::now()) < due)
+            {
+                // spin
+            }
+            uint64 errorMicros = (uint64)std::chrono::duration_cast<std::chrono::microseconds>(now - due).count();
+            int bucket = 0;
+            while (bucket < HISTOGRAM_BUCKETS - 1 && errorMicros >= (1ULL << bucket))
+            {
+                bucket++;
+            }
+            histogram[bucket]++;
+            totalErrorMicros += (double)errorMicros;
+            if (errorMicros > maxErrorMicros)
+            {
+                maxErrorMicros = errorMicros;
+            }
+        }
+        filter.process(timestamp, packet);
+        sentPackets++;
+        sentWords += (uint64)packet.getSizeInWords();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    writer.close();
+#ifdef TARGET_APPLE
+    outputDevice.close();
+#endif
+
+    PRINT("Sent %llu packets (%llu words), skipped %llu, in %.3f seconds.",
+          sentPackets, sentWords, reader.getPacketCount() - sentPackets, seconds);
+    if (seconds > 0)
+    {
+        PRINT("Throughput: %.0f packets/s, %.0f words/s.", sentPackets / seconds, sentWords / seconds);
+    }
+    if (speed > 0 && sentPackets > 0)
+    {
+        PRINT("Timing error: mean %.1fus, max %lluus.", totalErrorMicros / sentPackets, maxErrorMicros);
+        printHistogram(histogram, sentPackets);
+    }
+    return 0;
+}